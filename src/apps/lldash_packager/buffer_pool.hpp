@@ -0,0 +1,81 @@
+#pragma once
+
+#include "ingest_queue.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Size-classed memory recycler for frame payloads. Classes are powers of
+// two from 4 KiB to 64 MiB; each class keeps at most 'maxPerClass' free
+// blocks, so the retained memory stays bounded. Larger requests, or an
+// empty class, fall back to the heap (a miss). Thread-safe and lock-free.
+class BufferPool {
+	public:
+		struct Block {
+			uint8_t* ptr;
+			size_t capacity;
+		};
+
+		explicit BufferPool(size_t maxPerClass) {
+			for (int i = 0; i < NumClasses; ++i)
+				classes.push_back(std::make_unique<IngestQueue<uint8_t*>>(maxPerClass));
+		}
+
+		~BufferPool() {
+			for (auto &c : classes) {
+				uint8_t* ptr;
+				while (c->tryPop(ptr))
+					delete[] ptr;
+			}
+		}
+
+		Block acquire(size_t size) {
+			auto const c = classOf(size);
+			if (c < 0) {
+				misses++;
+				return { new uint8_t[size], size };
+			}
+
+			uint8_t* ptr;
+			if (classes[c]->tryPop(ptr)) {
+				hits++;
+				cachedBytes -= capacityOf(c);
+			} else {
+				misses++;
+				ptr = new uint8_t[capacityOf(c)];
+			}
+			return { ptr, capacityOf(c) };
+		}
+
+		void release(Block block) {
+			auto const c = classOf(block.capacity);
+			if (c >= 0 && capacityOf(c) == block.capacity) {
+				// counted before it can be popped, so that the count never goes below zero
+				cachedBytes += block.capacity;
+				if (classes[c]->tryPush(block.ptr))
+					return;
+				cachedBytes -= block.capacity;
+			}
+			delete[] block.ptr;
+		}
+
+		std::atomic<uint64_t> hits { 0 }, misses { 0 }, cachedBytes { 0 };
+
+	private:
+		static constexpr int MinShift = 12, NumClasses = 15; // 4 KiB .. 64 MiB
+
+		static int classOf(size_t size) {
+			for (int c = 0; c < NumClasses; ++c)
+				if (size <= capacityOf(c))
+					return c;
+			return -1;
+		}
+
+		static size_t capacityOf(int c) {
+			return (size_t)1 << (MinShift + c);
+		}
+
+		std::vector<std::unique_ptr<IngestQueue<uint8_t*>>> classes;
+};
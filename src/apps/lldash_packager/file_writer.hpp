@@ -0,0 +1,356 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+// Write-behind file output. Producers only queue references to their
+// buffers; a dedicated I/O thread takes everything queued since its last
+// pass as one batch, coalesces it per file and writes each file with
+// vectored writes. A file rewritten several times within a batch (e.g. the
+// MPD) is only written in its last version, through a temporary file and a
+// rename so that readers never see it partially written.
+// With a positive 'minBatchBytes', the I/O thread waits for that much data
+// (or for MaxLingerInMs) before writing, which turns a stream of small
+// chunks into large sequential writes.
+// When 'retentionInMs' is positive, the prunable files (media segments) are
+// deleted that long after their creation, so that disk usage stays bounded.
+// When storage stalls, at most 'maxPendingBytes' are queued: beyond that,
+// chunks are dropped and counted rather than pinning more memory. Chunks
+// are whole fragments, so a file missing some is still well-formed.
+class FileWriter {
+	public:
+		enum Sync {
+			NoSync = 0,        // leave it to the OS
+			SyncOnClose = 1,   // fsync each file when it is complete
+			SyncEachBatch = 2, // fsync each file written by a batch
+		};
+
+		typedef std::function<int64_t()> Clock; // milliseconds, monotonic
+		typedef std::function<void(std::string const&)> ErrorCallback;
+
+		FileWriter(std::string directory, Sync sync, int64_t retentionInMs, Clock nowInMs, ErrorCallback onError, size_t maxPendingBytes, size_t minBatchBytes = 0)
+			: directory(std::move(directory)), sync(sync), retentionInMs(retentionInMs), nowInMs(nowInMs), onError(onError),
+			  maxPendingBytes((int64_t)maxPendingBytes), minBatchBytes((int64_t)minBatchBytes) {
+			worker = std::thread([this]() { run(); });
+		}
+
+		// Writes what is queued, then stops the I/O thread.
+		~FileWriter() {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				done = true;
+			}
+			cv.notify_one();
+			worker.join();
+		}
+
+		// 'owner' keeps [ptr, ptr + len) alive until it is written.
+		// The file is complete after a write with 'eos' set: the next write
+		// to the same filename starts it over.
+		void write(std::string filename, std::shared_ptr<const void> owner, const uint8_t* ptr, size_t len, bool eos, bool prunable) {
+			int64_t pending;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (len && pendingBytes + (int64_t)len > maxPendingBytes) {
+					dropped++;
+					droppedBytes += len;
+					if (!eos)
+						return;
+					// still complete the file
+					owner = nullptr;
+					ptr = nullptr;
+					len = 0;
+				}
+				pending = pendingBytes += len;
+				jobs.push_back({ std::move(filename), std::move(owner), ptr, len, eos, prunable });
+			}
+			if (pending >= minBatchBytes)
+				cv.notify_one();
+		}
+
+		// Completes a file written without 'eos', once what is queued for it is written.
+		void close(std::string filename) {
+			write(std::move(filename), nullptr, nullptr, 0, true, false);
+		}
+
+		std::atomic<uint64_t> bytesWritten { 0 }, writeCalls { 0 }, batches { 0 };
+		std::atomic<uint64_t> coalesced { 0 }, pruned { 0 }, errors { 0 };
+		std::atomic<uint64_t> dropped { 0 }, droppedBytes { 0 };
+		std::atomic<int64_t> pendingBytes { 0 };
+
+	private:
+		struct Job {
+			std::string filename;
+			std::shared_ptr<const void> owner;
+			const uint8_t* ptr;
+			size_t len;
+			bool eos, prunable;
+		};
+
+		// What a batch writes to one file.
+		struct Pending {
+			std::string filename;
+			std::vector<const Job*> chunks;
+			bool truncate = false, eos = false, prunable = false;
+		};
+
+		static constexpr int MaxChunksPerCall = 64; // below IOV_MAX everywhere
+		static constexpr int MaxLingerInMs = 1000;
+
+		void run() {
+			std::vector<Job> batch;
+			auto lastBatch = std::chrono::steady_clock::now();
+			auto const ready = [&]() {
+				return done || (!jobs.empty() && (pendingBytes >= minBatchBytes
+					|| std::chrono::steady_clock::now() >= lastBatch + std::chrono::milliseconds(MaxLingerInMs)));
+			};
+			for (;;) {
+				{
+					// the timeout keeps pruning going when nothing is written
+					std::unique_lock<std::mutex> lock(mutex);
+					cv.wait_for(lock, std::chrono::milliseconds(MaxLingerInMs), ready);
+					if (jobs.empty() && done)
+						break;
+					if (ready()) {
+						batch.swap(jobs);
+						lastBatch = std::chrono::steady_clock::now();
+					}
+				}
+				if (!batch.empty())
+					writeBatch(batch);
+				batch.clear();
+				prune();
+			}
+
+			// what is still open is complete now
+			for (auto &f : openFiles)
+				closeFile(f.second, sync != NoSync);
+			openFiles.clear();
+		}
+
+		void writeBatch(std::vector<Job> const& batch) {
+			batches++;
+
+			std::vector<Pending> files;
+			std::map<std::string, size_t> index;
+			for (auto &job : batch) {
+				auto i = index.find(job.filename);
+				if (i == index.end()) {
+					i = index.emplace(job.filename, files.size()).first;
+					files.emplace_back();
+					files.back().filename = job.filename;
+					files.back().truncate = !openFiles.count(job.filename);
+				}
+
+				auto &p = files[i->second];
+				if (p.eos) {
+					// a newer version of a file completed in this batch
+					coalesced += p.chunks.size();
+					for (auto c : p.chunks)
+						pendingBytes -= c->len;
+					p.chunks.clear();
+					p.truncate = true;
+					p.eos = false;
+				}
+				p.chunks.push_back(&job);
+				p.eos = job.eos;
+				p.prunable = job.prunable;
+			}
+
+			for (auto &p : files)
+				writeFile(p);
+		}
+
+		void writeFile(Pending const& p) {
+			auto const path = directory + p.filename;
+			auto open = openFiles.find(p.filename);
+			if (open == openFiles.end() && p.eos && p.chunks.size() == 1 && !p.chunks[0]->len)
+				return; // close() of a file never written, or whose only chunk was dropped
+
+			if (p.truncate && open != openFiles.end()) {
+				closeFile(open->second, false);
+				openFiles.erase(open);
+				open = openFiles.end();
+			}
+
+			// whole files are renamed into place
+			auto const whole = p.truncate && p.eos;
+			auto const target = whole ? path + ".tmp" : path;
+			int fd = -1;
+			if (open != openFiles.end()) {
+				fd = open->second;
+			} else {
+				fd = openFile(target);
+				if (fd < 0) {
+					fail("can't open \"" + target + "\"");
+					for (auto c : p.chunks)
+						pendingBytes -= c->len;
+					return;
+				}
+				if (p.prunable && retentionInMs > 0)
+					created.push_back({ nowInMs(), p.filename });
+			}
+
+			size_t written = 0;
+			for (size_t i = 0; i < p.chunks.size(); i += MaxChunksPerCall) {
+				auto const n = std::min<size_t>(MaxChunksPerCall, p.chunks.size() - i);
+				if (!writeChunks(fd, p.chunks.data() + i, n))
+					fail("can't write \"" + target + "\"");
+				for (size_t j = i; j < i + n; ++j)
+					written += p.chunks[j]->len;
+			}
+			bytesWritten += written;
+			pendingBytes -= written;
+
+			if (p.eos) {
+				closeFile(fd, sync != NoSync);
+				if (open != openFiles.end())
+					openFiles.erase(open);
+				if (whole) {
+					std::error_code ec;
+					std::filesystem::rename(target, path, ec);
+					if (ec)
+						fail("can't rename \"" + target + "\": " + ec.message());
+				}
+			} else {
+				if (sync == SyncEachBatch)
+					syncFile(fd);
+				openFiles[p.filename] = fd;
+			}
+		}
+
+		// Deletes the prunable files that have left the retention window.
+		void prune() {
+			if (retentionInMs <= 0)
+				return;
+
+			auto const now = nowInMs();
+			while (!created.empty() && created.front().first + retentionInMs < now) {
+				auto const &filename = created.front().second;
+				auto const open = openFiles.find(filename);
+				if (open != openFiles.end()) {
+					closeFile(open->second, false);
+					openFiles.erase(open);
+				}
+				std::error_code ec;
+				if (std::filesystem::remove(directory + filename, ec))
+					pruned++;
+				created.pop_front();
+			}
+		}
+
+		int openFile(std::string const& path) {
+			auto const parent = std::filesystem::path(path).parent_path();
+			if (!parent.empty() && !createdDirs.count(parent.string())) {
+				std::error_code ec;
+				std::filesystem::create_directories(parent, ec);
+				createdDirs.insert(parent.string());
+			}
+#ifdef _WIN32
+			return _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+			return ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+		}
+
+		bool writeChunks(int fd, const Job* const* chunks, size_t n) {
+#ifdef _WIN32
+			for (size_t i = 0; i < n; ++i) {
+				writeCalls++;
+				if (_write(fd, chunks[i]->ptr, (unsigned)chunks[i]->len) != (int)chunks[i]->len)
+					return false;
+			}
+			return true;
+#else
+			iovec iov[MaxChunksPerCall];
+			for (size_t i = 0; i < n; ++i)
+				iov[i] = { (void*)chunks[i]->ptr, chunks[i]->len };
+
+			// complete the short writes
+			auto first = iov;
+			auto count = (int)n;
+			while (count > 0) {
+				writeCalls++;
+				auto res = ::writev(fd, first, count);
+				if (res < 0)
+					return false;
+				while (count > 0 && (size_t)res >= first->iov_len) {
+					res -= first->iov_len;
+					++first;
+					--count;
+				}
+				if (count > 0) {
+					first->iov_base = (uint8_t*)first->iov_base + res;
+					first->iov_len -= res;
+				}
+			}
+			return true;
+#endif
+		}
+
+		static void syncFile(int fd) {
+#ifdef _WIN32
+			_commit(fd);
+#else
+			::fsync(fd);
+#endif
+		}
+
+		static void closeFile(int fd, bool withSync) {
+			if (withSync)
+				syncFile(fd);
+#ifdef _WIN32
+			_close(fd);
+#else
+			::close(fd);
+#endif
+		}
+
+		void fail(std::string const& msg) {
+			errors++;
+			if (onError)
+				onError(msg);
+		}
+
+		std::string const directory;
+		Sync const sync;
+		int64_t const retentionInMs;
+		Clock const nowInMs;
+		ErrorCallback const onError;
+		int64_t const maxPendingBytes;
+		int64_t const minBatchBytes;
+
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::vector<Job> jobs;
+		bool done = false;
+		std::thread worker;
+
+		// I/O thread only
+		std::map<std::string, int> openFiles;
+		std::deque<std::pair<int64_t, std::string>> created;
+		std::set<std::string> createdDirs;
+};
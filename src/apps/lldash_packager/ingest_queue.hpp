@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Bounded lock-free multi-producer/multi-consumer queue (D. Vyukov's
+// algorithm). Unlike a SPSC fifo, a producer can evict the oldest element
+// to make room, which the drop-oldest overflow policy relies on.
+template<typename T>
+class IngestQueue {
+	public:
+		explicit IngestQueue(size_t capacity) : cells(new Cell[capacity]), cap(capacity) {
+			for (size_t i = 0; i < cap; ++i)
+				cells[i].seq.store(i, std::memory_order_relaxed);
+		}
+
+		bool tryPush(T value) {
+			auto pos = tail.load(std::memory_order_relaxed);
+			for (;;) {
+				auto &cell = cells[pos % cap];
+				auto const seq = cell.seq.load(std::memory_order_acquire);
+				auto const diff = (intptr_t)seq - (intptr_t)pos;
+				if (diff == 0) {
+					if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						cell.value = std::move(value);
+						cell.seq.store(pos + 1, std::memory_order_release);
+						return true;
+					}
+				} else if (diff < 0) {
+					return false; // full
+				} else {
+					pos = tail.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		bool tryPop(T &value) {
+			auto pos = head.load(std::memory_order_relaxed);
+			for (;;) {
+				auto &cell = cells[pos % cap];
+				auto const seq = cell.seq.load(std::memory_order_acquire);
+				auto const diff = (intptr_t)seq - (intptr_t)(pos + 1);
+				if (diff == 0) {
+					if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						value = std::move(cell.value);
+						cell.value = T();
+						cell.seq.store(pos + cap, std::memory_order_release);
+						return true;
+					}
+				} else if (diff < 0) {
+					return false; // empty
+				} else {
+					pos = head.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		// Approximate when other threads are pushing or popping concurrently.
+		size_t size() const {
+			auto const h = head.load(std::memory_order_relaxed);
+			auto const t = tail.load(std::memory_order_relaxed);
+			return t > h ? t - h : 0;
+		}
+
+		size_t capacity() const {
+			return cap;
+		}
+
+	private:
+		struct Cell {
+			std::atomic<size_t> seq;
+			T value;
+		};
+
+		std::unique_ptr<Cell[]> cells;
+		size_t const cap;
+		alignas(64) std::atomic<size_t> head { 0 };
+		alignas(64) std::atomic<size_t> tail { 0 };
+};
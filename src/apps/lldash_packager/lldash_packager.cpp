@@ -14,188 +14,1376 @@
 #include "lib_utils/log.hpp"
 #include "lib_utils/time.hpp" //getUTC()
 #include "lib_utils/system_clock.hpp"
-#include "lib_utils/queue_lockfree.hpp"
+#include "buffer_pool.hpp"
+#include "file_writer.hpp"
+#include "ingest_queue.hpp"
+#include "notifier.hpp"
+#include "stats.hpp"
+#include "stream_table.hpp"
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstdarg>
 #include <cstdio>
+#include <map>
+#include <mutex>
+#include <thread>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 using namespace Modules;
 using namespace Pipelines;
 using namespace std;
 using namespace chrono;
 
+// Messages are formatted into preallocated slots and delivered to the user
+// callbacks by a background thread, so that logging never allocates nor
+// blocks the media path. When all the slots are in use, messages are
+// dropped and counted. Shared by the handles of a context.
+struct LogDelivery
+{
+  LogDelivery() : freeSlots(NumSlots), readySlots(NumSlots) {
+	for (int i = 0; i < NumSlots; ++i)
+		freeSlots.tryPush(i);
+	worker = thread([this]() { run(); });
+  }
+
+  // Delivers the pending messages, then stops the background thread.
+  ~LogDelivery() {
+	done = true;
+	wakeup.notify();
+	worker.join();
+  }
+
+  bool post(Level level, LLDashPackagerMessageCallback callback, const char* name, const char* fmt, va_list args) {
+	int idx;
+	if (!freeSlots.tryPop(idx)) {
+		dropped++;
+		return false;
+	}
+
+	auto &slot = slots[idx];
+	slot.level = level;
+	slot.callback = callback;
+	auto const prefix = std::min<size_t>(snprintf(slot.text, MaxMessageSize, "[lldpkg::%s] ", name), MaxMessageSize - 1);
+	vsnprintf(slot.text + prefix, MaxMessageSize - prefix, fmt, args);
+	strcat(slot.text, "\n"); // the text has room for it
+	readySlots.tryPush(idx); // can't fail: there are as many entries as slots
+
+	if (level == Level::Error)
+		wakeup.notify();
+	return true;
+  }
+
+private:
+  void run() {
+	uint64_t reportedDrops = 0;
+	for (;;) {
+		int idx;
+		if (!readySlots.tryPop(idx)) {
+			if (done)
+				break;
+			wakeup.wait(chrono::milliseconds(20));
+			continue;
+		}
+
+		auto &slot = slots[idx];
+		auto const numDropped = dropped.load();
+		if (numDropped != reportedDrops) {
+			char msg[64];
+			snprintf(msg, sizeof(msg), "[lldpkg] %llu message(s) dropped\n", (unsigned long long)(numDropped - reportedDrops));
+			deliver(Level::Warning, slot.callback, msg);
+			reportedDrops = numDropped;
+		}
+
+		deliver(slot.level, slot.callback, slot.text);
+		freeSlots.tryPush(idx);
+	}
+  }
+
+  static void deliver(Level level, LLDashPackagerMessageCallback callback, const char* msg) {
+	if (callback) {
+		callback(msg, (int)level);
+	} else {
+		fputs(msg, stderr);
+		fflush(stderr);
+	}
+  }
+
+  static constexpr int NumSlots = 1024;
+  static constexpr size_t MaxMessageSize = 512;
+  struct Slot {
+	Level level;
+	LLDashPackagerMessageCallback callback;
+	char text[MaxMessageSize + 1];
+  };
+  Slot slots[NumSlots];
+  IngestQueue<int> freeSlots, readySlots;
+  atomic<uint64_t> dropped { 0 };
+  Notifier wakeup;
+  atomic<bool> done { false };
+  thread worker;
+};
+
+// Per-handle front of a LogDelivery: messages keep their handle's name and callback.
 struct Logger : LogSink
 {
   void send(Level level, const char* msg) override
   {
-	if(level > maxLevel)
+	logf(level, "%s", msg);
+  }
+
+  // Checks the level before doing any formatting.
+  void logf(Level level, const char* fmt, ...)
+#ifdef __GNUC__
+	__attribute__((format(printf, 3, 4)))
+#endif
+  {
+	if(level > maxLevel || !delivery)
 		return;
 
-	if (onError) {
-		onError(format("[lldpkg::%s] %s\n", name.c_str(), msg).c_str(), (int)level);
-	} else {
-		fprintf(stderr, "[lldpkg::%s] %s\n", name.c_str(), msg);
-		fflush(stderr);
-	}
+	va_list args;
+	va_start(args, fmt);
+	if (!delivery->post(level, onError, name.c_str(), fmt, args))
+		dropped++;
+	va_end(args);
   }
 
   Level maxLevel = Level::Info;
   string name;
-  std::function<void(const char*, int level)> onError = nullptr;
+  LLDashPackagerMessageCallback onError = nullptr;
+  atomic<uint64_t> dropped { 0 };
+  shared_ptr<LogDelivery> delivery;
+};
+
+struct IngestItem {
+	Data data;
+	int64_t pushTimeInNs = 0;
+};
+
+// Time only moves when the application advances it (lldpkg_advance_clock).
+struct VirtualClock : IClock {
+	Fraction now() const override {
+		return Fraction(timeIn180k.load(), IClock::Rate);
+	}
+	void sleep(Fraction) const override {}
+	atomic<int64_t> timeIn180k { 0 };
+};
+
+// State shared by the handles of a context (lldpkg_context_create). The
+// handles keep it alive, so that the context can be destroyed before them.
+struct SharedContext {
+	Logger logger; // first: destroyed last. Process-wide: gets the logs that can't be attributed to a handle
+
+	shared_ptr<Pipeline> pipe;
+	shared_ptr<mutex> pipeMutex = make_shared<mutex>(); // serializes the topology changes of all the handles
+	shared_ptr<BufferPool> pool;
+	int httpConnections = 4;
+	int httpRetryCount = 0;
+	map<string, IFilter*> publishers; // HTTP connection pools, by origin. Under pipeMutex
+
+	mutex handlesMutex;
+	vector<lldpkg_handle*> handles;
+};
+
+struct lldpkg_context {
+	shared_ptr<SharedContext> shared;
 };
 
 struct lldpkg_handle {
-	lldpkg_handle(int num_streams) : streams(num_streams) {}
+	Logger logger; // first: destroyed last, as the pipeline logs into it until the end
+	shared_ptr<SharedContext> context; // null for a standalone handle. Outlives the pipeline, which logs into it
+	shared_ptr<FileWriter> fileWriter; // VRTFileWriteBehind only. Drained after the pipeline is gone
+	shared_ptr<FileWriter> archiveWriter; // null unless archive_path is set
+	~lldpkg_handle();
 
 	struct Stream {
-		Stream() : fifo(256) {}
-		int64_t initTimeIn180k = fractionToClock(g_SystemClock->now());
-		int64_t timeIn180k = -1;
-		QueueLockFree<Data> fifo;
+		// a 'detached' stream isn't pushable until its branch is connected
+		Stream(LLDashPackagerStreamOptions const& opts, bool detached = false)
+			: fifo(opts.queue_capacity ? opts.queue_capacity : 256),
+			  overflowPolicy(opts.overflow_policy),
+			  blockTimeout(opts.block_timeout_in_ms ? opts.block_timeout_in_ms : 1000),
+			  fragmentFrames(opts.fragment_frames),
+			  fragmentDurationIn180k(rescale(opts.fragment_duration_in_ms, 1000, IClock::Rate)),
+			  shedPriority(opts.shed_priority) {
+			removed = detached;
+		}
+		atomic<int64_t> timeIn180k { -1 };
+		IngestQueue<IngestItem> fifo;
+		Data primer; // the metadata, posted ahead of the fifo: no overflow policy can evict it
+		atomic<bool> primerPending { false };
+		shared_ptr<Notifier> notifier; // signaled by producers: data available, shared by the streams of a source
+		Notifier space;                // signaled by the consumer: room available
+		int const overflowPolicy;
+		chrono::milliseconds const blockTimeout;
+
+		// serializes the producers of the stream: the state below is only
+		// touched with it held, so that stamping and queueing happen in one order
+		mutex producer;
+		int64_t lastDtsIn180k = INT64_MIN;
+
+		// fragment aggregation: only the first frame of a fragment keeps its RAP flag
+		bool aggregates() const {
+			return fragmentFrames > 1 || fragmentDurationIn180k > 0;
+		}
+		int const fragmentFrames;
+		int64_t const fragmentDurationIn180k;
+		int framesInFragment = 0;
+		int64_t fragmentStartIn180k = 0;
+		atomic<int64_t> fragmentDurIn180k { 0 }; // of the last complete fragment: how long the muxer holds a frame
+		shared_ptr<DataRaw> lease;
+
+		// load shedding: once shed, the stream resumes on a keyframe
+		int shedPriority;
+		bool shedding = false;
+		atomic<uint64_t> shed { 0 };
+
+		atomic<uint64_t> enqueued { 0 }, dropped { 0 }, rejected { 0 };
+		atomic<size_t> highWaterMark { 0 };
+
+		LatencyHistogram pushLatency, queueLatency, muxLatency;
+		atomic<uint64_t> bytes { 0 }, fragments { 0 }, fragmentBytes { 0 };
+		atomic<int64_t> muxPendingSinceInNs { 0 }; // oldest frame posted to the muxer and not yet seen out of it
+		atomic<int64_t> muxPendingPushInNs { 0 }; // push time of that frame
+
+		// pipeline branch: source pin -> muxer -> probe pin -> dasher input
+		atomic<bool> removed { false };
+		IFilter* source = nullptr;
+		int sourcePin = 0;
+		IFilter* muxer = nullptr;
+		IFilter* archive = nullptr; // null unless recording
+		IFilter* probe = nullptr;
+		int probePin = 0;
+		int dasherInput = 0;
+		bool ownsBranch = false; // source and probe are dedicated to this stream
 	};
-	vector<Stream> streams;
+	// indices are never reused: a removed stream keeps its slot until the handle goes away
+	StreamTable<Stream> streams;
+
+	shared_ptr<Pipeline> pipe;   // owned, or the one of the context
+	shared_ptr<BufferPool> pool; // may be null: payloads are then heap-allocated
+
+	// with a context, the handle leaves the shared pipeline by removing
+	// what it added: every module and connection is recorded
+	struct Link {
+		IFilter* src;
+		int srcPin;
+		IFilter* dst;
+		int dstPin;
+	};
+	vector<IFilter*> modules;
+	vector<Link> links;
+
+	// clock timestamps: shared by all the streams so that they stay aligned
+	shared_ptr<IClock> clock = g_SystemClock;
+	shared_ptr<VirtualClock> virtualClock; // null unless VRTClockVirtual
+	int64_t initTimeIn180k = 0;
+
+	// caller-supplied timestamps (lldpkg_push_frame)
+	int timescale = 1000;
+	atomic<int64_t> originTimestamp { NoOrigin };
+	static constexpr int64_t NoOrigin = INT64_MIN;
 
-	unique_ptr<Pipeline> pipe;
+	// session-wide: the dasher output can't be attributed to a stream
+	LatencyHistogram dashLatency, publishLatency, endToEndLatency;
+	atomic<int64_t> dashPendingSinceInNs { 0 };
+	atomic<int64_t> dashPendingPushInNs { 0 }; // push time of the oldest frame not yet seen out of the dasher
+	atomic<uint64_t> published { 0 }, publishedBytes { 0 };
+	atomic<uint64_t> mpdPublished { 0 }, mpdPublishedBytes { 0 }, mpdSuppressed { 0 };
 
-	bool error = false;
-	Logger logger;
-	std::function<bool(const char*)> errorCbk;
+	// topology, kept to attach and detach streams on the running pipeline
+	shared_ptr<mutex> pipeMutex = make_shared<mutex>(); // the context's one if any
+	IFilter* dasher = nullptr;
+	int nextDasherInput = 0;
+	int segDurInMs = 0;
+	CompatibilityFlag mp4Flags = None;
+	int waitStrategy = VRTWaitBlocking;
+	int spinCount = 0;
+
+	// load shedding: streams whose priority is among the 'shedLevel' highest ones are shed
+	int shedQueuePercent = 0;
+	int64_t shedLagInNs = 0;
+	int64_t segmentHoldInNs = 0; // without FlushFragMemory, the muxers hold each frame until its segment is complete
+	bool shedBySrd = false;
+	atomic<int> maxShedPriority { 0 };
+	atomic<int> shedLevel { 0 };
+	atomic<int64_t> nextShedCheckInNs { 0 };
+
+	// MPD rewriting, keyed by dasher input: the dasher names its Representations after them
+	vector<int> removedDasherInputs;
+	map<int, string> addedSrds; // SRD of the added streams, which the dasher doesn't know
+	mutex mpdMutex;
+
+	// two-phase creation (lldpkg_prepare, then lldpkg_bind)
+	LLDashPackagerOptions options {};
+	int timeshiftInMs = 0;
+	IFilter* sinkProbe = nullptr;
+	IFilter* mpdRewriter = nullptr;
+	atomic<bool> bound { false };
+
+	// startup: from the creation (or binding) call to the first media chunk at the sink
+	int64_t startInNs = 0;
+	int64_t startupInNs = 0;
+	atomic<int64_t> firstSegmentInNs { 0 };
+
+	atomic<bool> error { false }; // set by the pipeline error callback, read by the producers
 };
 
+static IFilter* addFilter(lldpkg_handle* h, const char* type, const void* cfg) {
+	auto filter = h->pipe->add(type, cfg);
+	h->modules.push_back(filter);
+	return filter;
+}
+
+template<typename T, typename... Args>
+static IFilter* addFilter(lldpkg_handle* h, Args&&... args) {
+	auto filter = h->pipe->addModule<T>(std::forward<Args>(args)...);
+	h->modules.push_back(filter);
+	return filter;
+}
+
+static void removeFilter(lldpkg_handle* h, IFilter* filter) {
+	h->pipe->removeModule(filter);
+	h->modules.erase(find(h->modules.begin(), h->modules.end(), filter));
+}
+
+static void link(lldpkg_handle* h, IFilter* src, int srcPin, IFilter* dst, int dstPin, bool multi = false) {
+	h->pipe->connect(GetOutputPin(src, srcPin), GetInputPin(dst, dstPin), multi);
+	h->links.push_back({ src, srcPin, dst, dstPin });
+}
+
+static void unlink(lldpkg_handle* h, IFilter* src, int srcPin, IFilter* dst, int dstPin) {
+	h->pipe->disconnect(src, srcPin, dst, dstPin);
+	h->links.erase(find_if(h->links.begin(), h->links.end(), [&](lldpkg_handle::Link const& l) {
+		return l.src == src && l.srcPin == srcPin && l.dst == dst && l.dstPin == dstPin;
+	}));
+}
+
+// Removes what was added to the pipeline since the topology had these sizes, newest first.
+static void rollback(lldpkg_handle* h, size_t numModules, size_t numLinks) {
+	while (h->links.size() > numLinks) {
+		auto const &l = h->links.back();
+		h->pipe->disconnect(l.src, l.srcPin, l.dst, l.dstPin);
+		h->links.pop_back();
+	}
+	while (h->modules.size() > numModules) {
+		h->pipe->removeModule(h->modules.back());
+		h->modules.pop_back();
+	}
+}
+
+// A handle of a context leaves the shared pipeline: the others keep running.
+lldpkg_handle::~lldpkg_handle() {
+	if (!context) {
+		// the pipeline threads use the members declared after 'pipe': stop them first
+		pipe.reset();
+		return;
+	}
+
+	try {
+		{
+			lock_guard<mutex> lock(context->handlesMutex);
+			auto &handles = context->handles;
+			handles.erase(remove(handles.begin(), handles.end(), this), handles.end());
+		}
+
+		for (auto &stream : streams)
+			if (stream.notifier)
+				stream.notifier->notify();
+
+		lock_guard<mutex> lock(*pipeMutex);
+		for (auto l = links.rbegin(); l != links.rend(); ++l)
+			pipe->disconnect(l->src, l->srcPin, l->dst, l->dstPin);
+		for (auto m = modules.rbegin(); m != modules.rend(); ++m)
+			pipe->removeModule(*m);
+	} catch (exception const& err) {
+		logger.logf(Level::Error, "[%s] can't leave the shared pipeline: %s", __func__, err.what());
+	}
+}
+
+static bool pinCurrentThread(int cpu) {
+#ifdef _WIN32
+	return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) != 0;
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	(void)cpu;
+	return false;
+#endif
+}
+
+// Feeds one or several streams: output i carries streams[i].
+// The streams share a single notifier, so one thread serves them all.
 struct ExternalSource : Modules::Module {
-	ExternalSource(Modules::KHost* host, QueueLockFree<Data> &fifo) : fifo(fifo) {
-		out = addOutput();
+	ExternalSource(Modules::KHost* host, vector<lldpkg_handle::Stream*> streams, int cpu) : host(host), streams(streams), cpu(cpu) {
+		for (size_t i = 0; i < streams.size(); ++i)
+			outputs.push_back(addOutput());
 		host->activate(true);
 	}
+	void process() override {
+		if (cpu >= 0) {
+			if (!pinCurrentThread(cpu))
+				host->log(Warning, format("Can't pin ingest thread to CPU %s", cpu).c_str());
+			cpu = -1;
+		}
+
+		// round-robin so that a busy stream can't starve the others
+		bool idle = true;
+		for (size_t i = 0; i < streams.size(); ++i) {
+			IngestItem item;
+			auto const popped = streams[i]->fifo.tryPop(item);
+			// checked after the pop: nothing is pushed before the primer is set, so it still goes first
+			if (streams[i]->primerPending.exchange(false)) {
+				outputs[i]->post(streams[i]->primer);
+				streams[i]->primer = nullptr;
+				idle = false;
+			}
+			if (!popped)
+				continue;
+			streams[i]->space.notify();
+
+			auto const now = nowInNs();
+			if (item.pushTimeInNs) {
+				streams[i]->queueLatency.record(now - item.pushTimeInNs);
+				int64_t none = 0;
+				if (streams[i]->muxPendingSinceInNs.compare_exchange_strong(none, now))
+					streams[i]->muxPendingPushInNs = item.pushTimeInNs;
+			}
+			outputs[i]->post(item.data);
+			idle = false;
+		}
+
+		if (idle)
+			streams[0]->notifier->wait(chrono::milliseconds(50));
+	}
+	Modules::KHost* const host;
+	vector<lldpkg_handle::Stream*> const streams;
+	vector<Modules::OutputDefault*> outputs;
+	int cpu;
+};
+
+// Pass-through module: input i is forwarded to output i, with a callback
+// observing each data on the way. Used to timestamp stage boundaries.
+struct StageProbe : Modules::Module {
+	StageProbe(Modules::KHost*, int numPins, function<void(int, Data const&)> onData) : onData(onData) {
+		for (int i = 0; i < numPins; ++i) {
+			inputs.push_back(addInput());
+			outputs.push_back(addOutput());
+		}
+	}
+	void process() override {
+		for (size_t i = 0; i < inputs.size(); ++i) {
+			Data data;
+			while (inputs[i]->tryPop(data)) {
+				onData((int)i, data);
+				outputs[i]->post(data);
+			}
+		}
+	}
+	function<void(int, Data const&)> const onData;
+	vector<Modules::KInput*> inputs;
+	vector<Modules::OutputDefault*> outputs;
+};
+
+// Spreads the dasher output over several sinks: input 1 (the MPD) has
+// output 0 to itself, and each file of input 0 sticks to one of the other
+// outputs so that its chunks are uploaded in order over the same connection.
+// With a single output, everything goes to it.
+struct PublishRouter : Modules::Module {
+	PublishRouter(Modules::KHost*, int numOutputs) {
+		if (numOutputs < 1)
+			throw runtime_error("PublishRouter: needs at least 1 output");
+		for (int i = 0; i < 2; ++i)
+			inputs.push_back(addInput());
+		for (int i = 0; i < numOutputs; ++i)
+			outputs.push_back(addOutput());
+	}
 	void process() override {
 		Data data;
-		if(!fifo.read(data)) {
-			this_thread::sleep_for(chrono::milliseconds(10));
+		while (inputs[1]->tryPop(data))
+			outputs[0]->post(data);
+		while (inputs[0]->tryPop(data)) {
+			auto const meta = dynamic_cast<const MetadataFile*>(data->getMetadata().get());
+			if (outputs.size() == 1) {
+				outputs[0]->post(data);
+				continue;
+			}
+			auto const idx = meta ? hash<string>()(meta->filename) % (outputs.size() - 1) : 0;
+			outputs[1 + idx]->post(data);
+		}
+	}
+	vector<Modules::KInput*> inputs;
+	vector<Modules::OutputDefault*> outputs;
+};
+
+// Rewrites each MPD produced by the dasher. An empty result drops it.
+struct MpdRewriter : Modules::ModuleS {
+	MpdRewriter(Modules::KHost*, function<string(string)> rewrite) : rewrite(rewrite) {
+		out = addOutput();
+	}
+	void processOne(Data data) override {
+		auto const meta = dynamic_cast<const MetadataFile*>(data->getMetadata().get());
+		if (!meta) {
+			out->post(data);
+			return;
+		}
+
+		auto const original = string((const char*)data->data().ptr, data->data().len);
+		auto const mpd = rewrite(original);
+		if (mpd.empty())
+			return; // suppressed
+		if (mpd == original) {
+			out->post(data);
 			return;
 		}
-		out->post(data);
+		auto res = make_shared<DataRaw>(mpd.size());
+		memcpy(res->buffer->data().ptr, mpd.data(), mpd.size());
+		auto newMeta = make_shared<MetadataFile>(*meta);
+		newMeta->filesize = mpd.size();
+		res->setMetadata(newMeta);
+		out->post(res);
 	}
+	function<string(string)> const rewrite;
 	Modules::OutputDefault* out;
-	QueueLockFree<Data> &fifo;
 };
 
+// Prepends a path to the name of the files: input i is forwarded to output i.
+// Lets handles with different publish URLs share the connections to a server.
+struct PathPrefixer : Modules::Module {
+	PathPrefixer(Modules::KHost*, int numPins, string prefix) : prefix(prefix) {
+		for (int i = 0; i < numPins; ++i) {
+			inputs.push_back(addInput());
+			outputs.push_back(addOutput());
+		}
+	}
+	void process() override {
+		for (size_t i = 0; i < inputs.size(); ++i) {
+			Data data;
+			while (inputs[i]->tryPop(data)) {
+				auto const meta = dynamic_cast<const MetadataFile*>(data->getMetadata().get());
+				auto const raw = dynamic_cast<const DataRaw*>(data.get());
+				if (!meta || !raw) {
+					outputs[i]->post(data);
+					continue;
+				}
+				auto res = make_shared<DataRaw>(0);
+				res->buffer = raw->buffer; // no copy
+				auto newMeta = make_shared<MetadataFile>(*meta);
+				newMeta->filename = prefix + meta->filename;
+				res->setMetadata(newMeta);
+				outputs[i]->post(res);
+			}
+		}
+	}
+	string const prefix;
+	vector<Modules::KInput*> inputs;
+	vector<Modules::OutputDefault*> outputs;
+};
+
+// Splits "http://host:port/path/" into "http://host:port/" and "path/".
+static void splitUrl(string const& url, string &origin, string &path) {
+	auto const scheme = url.find("://");
+	auto const pathStart = scheme == string::npos ? string::npos : url.find('/', scheme + 3);
+	if (pathStart == string::npos) {
+		origin = url + "/";
+		path.clear();
+	} else {
+		origin = url.substr(0, pathStart + 1);
+		path = url.substr(pathStart + 1);
+	}
+}
+
+// The HTTP connection pool of a context to 'origin': input 0 takes the
+// files, input 1 the MPDs. Created on first use. Needs the pipeline mutex.
+static IFilter* getPublisher(SharedContext* ctx, string const& origin) {
+	auto &publisher = ctx->publishers[origin];
+	if (!publisher) {
+		HttpOutputConfig sinkCfg {};
+		sinkCfg.url = origin;
+		sinkCfg.userAgent = "bin2dash";
+		sinkCfg.maxConnectFailCount = ctx->httpRetryCount;
+		publisher = ctx->pipe->addModule<PublishRouter>(ctx->httpConnections);
+		for (int i = 0; i < ctx->httpConnections; ++i)
+			ctx->pipe->connect(GetOutputPin(publisher, i), ctx->pipe->add("HttpSink", &sinkCfg));
+		ctx->logger.logf(Info, "Pushing to HTTP at \"%s\" over %d shared connection(s)", origin.c_str(), ctx->httpConnections);
+	}
+	return publisher;
+}
+
+// LL-DASH: segments can be requested before they are complete.
+static string addAvailabilityTimeOffset(string mpd, double offsetInSec) {
+	auto const attributes = format(" availabilityTimeOffset=\"%s\" availabilityTimeComplete=\"false\"", offsetInSec);
+	size_t pos = 0;
+	while ((pos = mpd.find("<SegmentTemplate", pos)) != string::npos) {
+		pos += strlen("<SegmentTemplate");
+		auto const end = mpd.find('>', pos);
+		if (mpd.substr(pos, end - pos).find("availabilityTimeOffset") == string::npos)
+			mpd.insert(pos, attributes);
+	}
+	return mpd;
+}
+
+// What's left of the MPD once the parts that change at each publication
+// (publishTime, generator comments) are removed.
+static string stableMpdPart(string mpd) {
+	size_t pos;
+	while ((pos = mpd.find("<!--")) != string::npos) {
+		auto const end = mpd.find("-->", pos);
+		mpd.erase(pos, end == string::npos ? string::npos : end + 3 - pos);
+	}
+	if ((pos = mpd.find(" publishTime=\"")) != string::npos)
+		mpd.erase(pos, mpd.find('"', pos + strlen(" publishTime=\"")) + 1 - pos);
+	return mpd;
+}
+
+// Drops the Representations with the given ids, then the AdaptationSets left empty.
+static string removeRepresentations(string mpd, vector<int> const& ids) {
+	for (auto id : ids) {
+		auto const start = mpd.find(format("<Representation id=\"%s\"", id));
+		if (start == string::npos)
+			continue;
+		auto const openEnd = mpd.find('>', start);
+		auto end = mpd[openEnd - 1] == '/' ? openEnd + 1 : mpd.find("</Representation>", openEnd) + strlen("</Representation>");
+		mpd.erase(start, end - start);
+	}
+
+	size_t pos = 0;
+	while ((pos = mpd.find("<AdaptationSet", pos)) != string::npos) {
+		auto const end = mpd.find("</AdaptationSet>", pos);
+		if (end == string::npos)
+			break;
+		if (mpd.substr(pos, end - pos).find("<Representation") == string::npos)
+			mpd.erase(pos, end + strlen("</AdaptationSet>") - pos);
+		else
+			pos = end;
+	}
+	return mpd;
+}
+
+// Gives the AdaptationSets of the given Representations the SRD they lack.
+static string addSrds(string mpd, map<int, string> const& srds) {
+	for (auto const &srd : srds) {
+		auto const repr = mpd.find(format("<Representation id=\"%s\"", srd.first));
+		if (repr == string::npos)
+			continue;
+		auto const set = mpd.rfind("<AdaptationSet", repr);
+		if (set == string::npos)
+			continue;
+		auto const setBody = mpd.find('>', set) + 1;
+		if (mpd.substr(setBody, repr - setBody).find("urn:mpeg:dash:srd:2014") != string::npos)
+			continue;
+		mpd.insert(setBody, format("<SupplementalProperty schemeIdUri=\"urn:mpeg:dash:srd:2014\" value=\"%s\"/>", srd.second));
+	}
+	return mpd;
+}
+
+// Hands the dasher output to the application without any copy.
+struct CallbackSink : Modules::ModuleS {
+	CallbackSink(Modules::KHost*, LLDashPackagerSegmentCallback cbk, void* userdata, LatencyHistogram &latency)
+		: cbk(cbk), userdata(userdata), latency(latency) {}
+	void processOne(Data data) override {
+		auto const meta = dynamic_cast<const MetadataFile*>(data->getMetadata().get());
+		if (!meta)
+			return;
+
+		LLDashPackagerSegment segment {};
+		segment.filename = meta->filename.c_str();
+		segment.data = data->data().ptr;
+		segment.size = data->data().len;
+		if (endsWith(meta->filename, ".mpd"))
+			segment.kind = VRTSegmentManifest;
+		else if (meta->filename.find("init") != string::npos)
+			segment.kind = VRTSegmentInit;
+		else
+			segment.kind = VRTSegmentMedia;
+		segment.eos = meta->EOS;
+
+		auto const t0 = nowInNs();
+		cbk(&segment, userdata);
+		latency.record(nowInNs() - t0);
+	}
+	static bool endsWith(string const& s, string const& suffix) {
+		return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+	}
+	LLDashPackagerSegmentCallback const cbk;
+	void* const userdata;
+	LatencyHistogram &latency;
+};
+
+// Hands the dasher output to a FileWriter: the pipeline thread only queues.
+struct WriteBehindSink : Modules::ModuleS {
+	WriteBehindSink(Modules::KHost*, shared_ptr<FileWriter> writer) : writer(writer) {}
+	void processOne(Data data) override {
+		auto const meta = dynamic_cast<const MetadataFile*>(data->getMetadata().get());
+		if (!meta)
+			return;
+
+		// each MPD is a complete document
+		auto const isMpd = CallbackSink::endsWith(meta->filename, ".mpd");
+		auto const prunable = !isMpd && meta->filename.find("init") == string::npos;
+		writer->write(meta->filename, data, data->data().ptr, data->data().len, meta->EOS || isMpd, prunable);
+	}
+	shared_ptr<FileWriter> const writer;
+};
+
+// Records the output of a muxer, in order, into a single file.
+struct ArchiveSink : Modules::ModuleS {
+	ArchiveSink(Modules::KHost*, shared_ptr<FileWriter> writer, string filename) : writer(writer), filename(filename) {}
+	void processOne(Data data) override {
+		if (data->data().len)
+			writer->write(filename, data, data->data().ptr, data->data().len, false, false);
+	}
+	shared_ptr<FileWriter> const writer;
+	string const filename;
+};
+
+// Payload memory borrowed from a BufferPool, returned to it when the last
+// reference held by the pipeline goes away.
+struct PooledBuffer : IBuffer {
+	PooledBuffer(shared_ptr<BufferPool> pool, size_t size) : pool(pool), block(pool->acquire(size)), size(size) {}
+	~PooledBuffer() {
+		pool->release(block);
+	}
+	Span data() override {
+		return Span{ block.ptr, size };
+	}
+	SpanC data() const override {
+		return SpanC{ block.ptr, size };
+	}
+	void resize(size_t newSize) override {
+		if (newSize > block.capacity)
+			throw runtime_error("PooledBuffer: can't grow beyond the pooled block");
+		size = newSize;
+	}
+	shared_ptr<BufferPool> const pool;
+	BufferPool::Block const block;
+	size_t size;
+};
+
+// Wraps caller-owned memory: the release callback fires when the last
+// reference held by the pipeline goes away.
+struct ExternalBuffer : IBuffer {
+	ExternalBuffer(const uint8_t* ptr, size_t size, LLDashPackagerReleaseCallback release, void* userdata)
+		: ptr(ptr), size(size), release(release), userdata(userdata) {}
+	~ExternalBuffer() {
+		if (release)
+			release(ptr, userdata);
+	}
+	Span data() override {
+		return Span{ const_cast<uint8_t*>(ptr), size };
+	}
+	SpanC data() const override {
+		return SpanC{ ptr, size };
+	}
+	void resize(size_t) override {
+		throw runtime_error("ExternalBuffer: can't resize caller-owned memory");
+	}
+	const uint8_t* const ptr;
+	const size_t size;
+	LLDashPackagerReleaseCallback const release;
+	void* const userdata;
+};
+
+static shared_ptr<DataRaw> allocData(lldpkg_handle* h, size_t size) {
+	if (!h->pool)
+		return make_shared<DataRaw>(size);
+	auto data = make_shared<DataRaw>(0);
+	data->buffer = make_shared<PooledBuffer>(h->pool, size);
+	return data;
+}
+
+static shared_ptr<DataRaw> copyData(lldpkg_handle* h, const uint8_t* buffer, size_t size) {
+	auto data = allocData(h, size);
+	memcpy(data->buffer->data().ptr, buffer, size);
+	return data;
+}
+
 static bool startsWith(string s, string prefix) {
   return s.substr(0, prefix.size()) == prefix;
 }
 
+static void checkStreamOptions(LLDashPackagerStreamOptions const& opts, int stream) {
+	if (opts.queue_capacity < 0)
+		throw std::runtime_error(format("Invalid queue capacity (%s) for stream %s. Aborting.", opts.queue_capacity, stream).c_str());
+	if (opts.overflow_policy < VRTOverflowReject || opts.overflow_policy > VRTOverflowBlock)
+		throw std::runtime_error(format("Invalid overflow policy (%s) for stream %s. Aborting.", opts.overflow_policy, stream).c_str());
+	if (opts.fragment_frames < 0 || opts.fragment_duration_in_ms < 0)
+		throw std::runtime_error(format("Invalid fragment aggregation for stream %s. Aborting.", stream).c_str());
+	if (opts.shed_priority < 0)
+		throw std::runtime_error(format("Invalid shed priority (%s) for stream %s. Aborting.", opts.shed_priority, stream).c_str());
+}
+
+// Ring of the tile around the picture center: 0 (never shed) for the
+// central third, up to 2 on the edges.
+static int srdShedPriority(StreamDesc const& desc) {
+	if (!desc.totalWidth || !desc.totalHeight)
+		return 0;
+	auto const dx = fabs(desc.objectX + desc.objectWidth / 2.0 - desc.totalWidth / 2.0) / (desc.totalWidth / 2.0);
+	auto const dy = fabs(desc.objectY + desc.objectHeight / 2.0 - desc.totalHeight / 2.0) / (desc.totalHeight / 2.0);
+	return std::min(2, (int)(std::max(dx, dy) * 3));
+}
+
+static void setShedPriority(lldpkg_handle* h, lldpkg_handle::Stream &stream, StreamDesc const& desc) {
+	if (!stream.shedPriority && h->shedBySrd)
+		stream.shedPriority = srdShedPriority(desc);
+	auto maxPriority = h->maxShedPriority.load();
+	while (stream.shedPriority > maxPriority && !h->maxShedPriority.compare_exchange_weak(maxPriority, stream.shedPriority)) {}
+}
+
+static shared_ptr<Notifier> makeNotifier(lldpkg_handle* h) {
+	auto notifier = make_shared<Notifier>();
+	notifier->strategy = (Notifier::Strategy)h->waitStrategy;
+	if (h->spinCount > 0)
+		notifier->spinCount = h->spinCount;
+	return notifier;
+}
+
+// A fragment of 'stream' came out of its muxer.
+static void onFragment(lldpkg_handle* h, int stream, Data const& data) {
+	auto &s = h->streams[stream];
+	auto const now = nowInNs();
+	auto const since = s.muxPendingSinceInNs.exchange(0);
+	if (since)
+		s.muxLatency.record(now - since);
+	auto const pushed = s.muxPendingPushInNs.exchange(0);
+	s.fragments++;
+	s.fragmentBytes += data->data().len;
+	int64_t none = 0;
+	h->dashPendingSinceInNs.compare_exchange_strong(none, now);
+	none = 0;
+	if (pushed)
+		h->dashPendingPushInNs.compare_exchange_strong(none, pushed);
+}
+
+// Archive writes are grouped up to this size: the recording isn't latency-sensitive.
+static constexpr size_t ArchiveBatchBytes = 1 << 20;
+
+// Memory a FileWriter may pin while storage stalls, before dropping.
+static constexpr size_t FileMaxPendingBytes = 256 << 20;
+
+static string asDirectory(string path) {
+	if (!path.empty() && path.back() != '/' && path.back() != '\\')
+		path += "/";
+	return path;
+}
+
+static string archiveName(lldpkg_handle* h, int stream) {
+	return format("%s-%s.mp4", h->logger.name, stream);
+}
+
+// Creates the muxer of 'stream' and connects its branch, whose source and
+// probe pins are already set, to a new dasher input. Then primes the muxer.
+static void connectStream(lldpkg_handle* h, int stream, StreamDesc const& desc) {
+	auto &s = h->streams[stream];
+
+	Mp4MuxConfig cfg {};
+	cfg.segmentDurationInMs = h->segDurInMs == 0 ? 1 : h->segDurInMs;
+	cfg.segmentPolicy = FragmentedSegment;
+	// aggregation: fragments are cut on the RAPs queueData() keeps
+	cfg.fragmentPolicy = s.aggregates() ? OneFragmentPerRAP : OneFragmentPerFrame;
+	cfg.compatFlags = h->mp4Flags;
+	cfg.MP4_4CC = desc.MP4_4CC;
+	s.muxer = addFilter(h, "GPACMuxMP4", &cfg);
+	s.dasherInput = h->nextDasherInput++;
+	link(h, s.source, s.sourcePin, s.muxer, 0);
+	link(h, s.muxer, 0, s.probe, s.probePin);
+	link(h, s.probe, s.probePin, h->dasher, s.dasherInput);
+	if (h->archiveWriter) {
+		s.archive = addFilter<ArchiveSink>(h, h->archiveWriter, archiveName(h, stream));
+		link(h, s.muxer, 0, s.archive, 0);
+	}
+
+	auto data = make_shared<DataRaw>(0);
+	auto meta = make_shared<MetadataPktVideo>();
+	meta->timeScale = Fraction(h->timescale, 1);
+	data->setMetadata(meta);
+	data->set(PresentationTime{ });
+	data->set(DecodingTime{ });
+	data->set(CueFlags{});
+	s.primer = data;
+	s.primerPending = true;
+	s.notifier->notify();
+}
+
 lldpkg_handle* lldpkg_create(const char* name, LLDashPackagerMessageCallback onError, int level, int num_streams, const StreamDesc* streams, const char* publish_url, int seg_dur_in_ms, int timeshift_buffer_depth_in_ms, uint64_t api_version) {
-	try {
-		if (api_version != LLDASH_PACKAGER_API_VERSION)
-			throw std::runtime_error(format("Inconsistent API version between compilation (%s) and runtime (%s). Aborting.", LLDASH_PACKAGER_API_VERSION, api_version).c_str());
+	return lldpkg_create_ex(name, onError, level, num_streams, streams, publish_url, seg_dur_in_ms, timeshift_buffer_depth_in_ms, nullptr, api_version);
+}
+
+// Everything that depends neither on the stream descriptors nor on the
+// publish URL: logger, clock, pool, pipeline, ingest threads, probes and
+// MPD rewriter. Not started.
+static unique_ptr<lldpkg_handle> prepareHandle(const char* name, LLDashPackagerMessageCallback onError, int level, int num_streams, int seg_dur_in_ms, int timeshift_buffer_depth_in_ms, const LLDashPackagerOptions* options, uint64_t api_version) {
+	if (api_version != LLDASH_PACKAGER_API_VERSION)
+		throw std::runtime_error(format("Inconsistent API version between compilation (%s) and runtime (%s). Aborting.", LLDASH_PACKAGER_API_VERSION, api_version).c_str());
+
+	LLDashPackagerOptions opts {};
+	if (options)
+		opts = *options;
+	if (opts.wait_strategy < VRTWaitBlocking || opts.wait_strategy > VRTWaitBusySpin)
+		throw std::runtime_error(format("Invalid wait strategy (%s). Aborting.", opts.wait_strategy).c_str());
+
+	if (opts.timescale < 0)
+		throw std::runtime_error(format("Invalid timescale (%s). Aborting.", opts.timescale).c_str());
 
-		auto h = make_unique<lldpkg_handle>(num_streams);
-		h->logger.name = name;
-		h->logger.maxLevel = (Level)level;
-		h->logger.setLevel((Level)level);
-		h->logger.onError = onError;
-		h->errorCbk = [onError](const char *msg) { 
-			if (onError) onError(msg, Level::Error);
-			return true;
-		};
+	if (opts.max_streams < 0)
+		throw std::runtime_error(format("Invalid maximum stream count (%s). Aborting.", opts.max_streams).c_str());
+
+	if (opts.fsync_policy < VRTFsyncNever || opts.fsync_policy > VRTFsyncEachBatch)
+		throw std::runtime_error(format("Invalid fsync policy (%s). Aborting.", opts.fsync_policy).c_str());
+
+	auto const ctx = opts.context ? opts.context->shared : nullptr;
+
+	auto h = make_unique<lldpkg_handle>();
+	if (opts.timescale)
+		h->timescale = opts.timescale;
+	if (ctx)
+		h->pool = ctx->pool;
+	else if (opts.pool_buffers_per_class >= 0)
+		h->pool = make_shared<BufferPool>(opts.pool_buffers_per_class ? opts.pool_buffers_per_class : 16);
+	if (opts.clock_mode == VRTClockVirtual) {
+		h->virtualClock = make_shared<VirtualClock>();
+		h->clock = h->virtualClock;
+	} else if (opts.clock_mode != VRTClockSystem) {
+		throw std::runtime_error(format("Invalid clock mode (%s). Aborting.", opts.clock_mode).c_str());
+	}
+	h->waitStrategy = opts.wait_strategy;
+	h->spinCount = opts.spin_count;
+	if (opts.shed_queue_percent < 0 || opts.shed_lag_in_ms < 0)
+		throw std::runtime_error("Invalid load shedding thresholds. Aborting.");
+	h->shedQueuePercent = opts.shed_queue_percent;
+	h->shedLagInNs = opts.shed_lag_in_ms * 1000000LL;
+	h->shedBySrd = opts.shed_by_srd != 0;
+	h->streams.reserve(std::max(num_streams, opts.max_streams ? opts.max_streams : 256));
+	for (int stream = 0; stream < num_streams; ++stream) {
+		LLDashPackagerStreamOptions streamOpts {};
+		if (opts.stream_options)
+			streamOpts = opts.stream_options[stream];
+		checkStreamOptions(streamOpts, stream);
+		h->streams.emplace_back(streamOpts);
+	}
+	h->logger.name = name;
+	h->logger.maxLevel = (Level)level;
+	h->logger.setLevel((Level)level);
+	h->logger.onError = onError;
+	h->logger.delivery = ctx ? ctx->logger.delivery : make_shared<LogDelivery>();
+	if (!ctx)
 		setGlobalLogger(h->logger);
 
-		// Pipeline
-		h->pipe = make_unique<Pipeline>(&h->logger, false, Threading::OnePerModule);
+	// kept for bindHandle(): pointers of the caller aren't
+	h->options = opts;
+	h->options.stream_options = nullptr;
+	h->options.archive_path = nullptr;
+	h->segDurInMs = seg_dur_in_ms;
+	h->timeshiftInMs = timeshift_buffer_depth_in_ms;
+
+	// Ingest threads: streams are dealt round-robin to the sources
+	int numSources = num_streams;
+	if (opts.threading == VRTThreadingPooled) {
+		numSources = opts.pool_size > 0 ? opts.pool_size : (int)thread::hardware_concurrency();
+		// no source at all without streams: a source needs one to wait on
+		numSources = std::min(std::max(1, numSources), num_streams);
+	} else if (opts.threading != VRTThreadingOnePerStream) {
+		throw std::runtime_error(format("Invalid threading (%s). Aborting.", opts.threading).c_str());
+	}
+	vector<vector<lldpkg_handle::Stream*>> sourceStreams(numSources);
+	for (int stream = 0; stream < num_streams; ++stream) {
+		auto &group = sourceStreams[stream % numSources];
+		if (group.empty()) {
+			group.push_back(&h->streams[stream]);
+			h->streams[stream].notifier = makeNotifier(h.get());
+		} else {
+			group.push_back(&h->streams[stream]);
+			h->streams[stream].notifier = group[0]->notifier;
+		}
+	}
+
+	// Pipeline
+	if (ctx) {
+		h->context = ctx;
+		h->pipe = ctx->pipe;
+		h->pipeMutex = ctx->pipeMutex;
+	} else {
+		h->pipe = make_shared<Pipeline>(&h->logger, false, Threading::OnePerModule);
 
 		// Error management
 		auto hErr = h.get();
-		h->pipe->registerErrorCallback([&](const char *str) {
-			h->logger.log(Info, format("Error flag set because \"%s\"", str).c_str());
+		h->pipe->registerErrorCallback([hErr](const char *str) {
+			hErr->logger.logf(Info, "Error flag set because \"%s\"", str);
 			hErr->error = true;
-			h->errorCbk(str);
+			hErr->logger.logf(Error, "%s", str);
 			return false;
 		});
+	}
+	// declared after 'h': on failure, released before a context handle leaves the pipeline
+	lock_guard<mutex> topologyLock(*h->pipeMutex);
+
+	// Archives: created before the streams are connected
+	if (opts.archive_path) {
+		auto hLog = h.get();
+		h->archiveWriter = make_shared<FileWriter>(asDirectory(opts.archive_path), (FileWriter::Sync)opts.fsync_policy, 0,
+			[]() { return (int64_t)0; },
+			[hLog](string const& msg) { hLog->logger.logf(Error, "[Archive] %s", msg.c_str()); },
+			FileMaxPendingBytes, ArchiveBatchBytes);
+		h->logger.logf(Info, "Recording to \"%s\"", opts.archive_path);
+	}
 
-		// Build parameters
-		auto mp4Flags = ExactInputDur | SegNumStartsAtZero;
-		if(startsWith(publish_url, "http")) {
-			mp4Flags = mp4Flags | FlushFragMemory;
+	// Probes: muxers -> dasher and dasher -> sink
+	auto hStats = h.get();
+	auto muxProbe = addFilter<StageProbe>(h.get(), num_streams, [hStats](int stream, Data const& data) {
+		onFragment(hStats, stream, data);
+	});
+	h->sinkProbe = addFilter<StageProbe>(h.get(), 2, [hStats](int pin, Data const& data) {
+		auto const since = hStats->dashPendingSinceInNs.exchange(0);
+		if (since)
+			hStats->dashLatency.record(nowInNs() - since);
+		hStats->published++;
+		hStats->publishedBytes += data->data().len;
+		if (pin == 1) {
+			hStats->mpdPublished++;
+			hStats->mpdPublishedBytes += data->data().len;
 		} else {
-			auto const prefix = Stream::AdaptiveStreamingCommon::getCommonPrefixVideo(0, Resolution(0, 0));
-			auto const subdir = prefix + "/";
-			if (!dirExists(subdir))
-				mkdir(subdir);
-		}
-
-		// Create Dasher
-		Modules::DasherConfig dashCfg {};
-		dashCfg.mpdName = format("%s.mpd", name);
-		dashCfg.live = true;
-		dashCfg.forceRealDurations = true;
-		dashCfg.presignalNextSegment = true;
-		dashCfg.segDurationInMs = seg_dur_in_ms;
-		dashCfg.timeShiftBufferDepthInMs = timeshift_buffer_depth_in_ms;
-		dashCfg.initialOffsetInMs = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
-		if (num_streams > 1)
-			for (int stream = 0; stream < num_streams; ++stream)
-				dashCfg.tileInfo.push_back({ 0, (int)streams[stream].objectX,
-					(int)streams[stream].objectY, (int)streams[stream].objectWidth,
-					(int)streams[stream].objectHeight, (int)streams[stream].totalWidth,
-					(int)streams[stream].totalHeight });
-		auto dasher = h->pipe->add("MPEG_DASH", &dashCfg);
-		
-		// Create sink
-		IFilter* sink = nullptr;
-		if(startsWith(publish_url, "http")) {
-			HttpOutputConfig sinkCfg {};
-			sinkCfg.url = publish_url;
-			sinkCfg.userAgent = "bin2dash";
-			sinkCfg.maxConnectFailCount = 0;
-			sink = h->pipe->add("HttpSink", &sinkCfg);
-			h->logger.log(Info, format("Pushing to HTTP at \"%s\"", publish_url).c_str());
+			auto const pushed = hStats->dashPendingPushInNs.exchange(0);
+			if (pushed)
+				hStats->endToEndLatency.record(nowInNs() - pushed);
+			if (!hStats->firstSegmentInNs) {
+				auto const meta = dynamic_cast<const MetadataFile*>(data->getMetadata().get());
+				if (meta && meta->filename.find("init") == string::npos)
+					hStats->firstSegmentInNs = nowInNs();
+			}
+		}
+	});
+
+	double offsetInSec = 0;
+	if (opts.ll_chunk_duration_in_ms > 0) {
+		if (opts.ll_chunk_duration_in_ms >= seg_dur_in_ms)
+			throw std::runtime_error("LL-DASH chunks must be shorter than segments. Aborting.");
+		offsetInSec = (seg_dur_in_ms - opts.ll_chunk_duration_in_ms) / 1000.0;
+	}
+	if (opts.mpd_update == VRTMpdOnChange && seg_dur_in_ms == 0)
+		throw std::runtime_error("Publishing the MPD on change only requires SegmentTemplate numbering (seg_dur_in_ms > 0). Aborting.");
+	else if (opts.mpd_update != VRTMpdEverySegment && opts.mpd_update != VRTMpdOnChange)
+		throw std::runtime_error(format("Invalid MPD update mode (%s). Aborting.", opts.mpd_update).c_str());
+	auto const onChangeOnly = opts.mpd_update == VRTMpdOnChange;
+	auto lastMpd = make_shared<string>(); // only touched by the rewriter thread
+	h->mpdRewriter = addFilter<MpdRewriter>(h.get(), [hStats, offsetInSec, onChangeOnly, lastMpd](string mpd) {
+		{
+			lock_guard<mutex> lock(hStats->mpdMutex);
+			mpd = removeRepresentations(mpd, hStats->removedDasherInputs);
+			mpd = addSrds(mpd, hStats->addedSrds);
+		}
+		if (onChangeOnly) {
+			auto stable = stableMpdPart(mpd);
+			if (stable == *lastMpd) {
+				hStats->mpdSuppressed++;
+				return string();
+			}
+			*lastMpd = move(stable);
+		}
+		if (offsetInSec > 0)
+			mpd = addAvailabilityTimeOffset(mpd, offsetInSec);
+		return mpd;
+	});
+
+	vector<IFilter*> sources;
+	auto const numCpus = std::max(1, (int)thread::hardware_concurrency());
+	for (int i = 0; i < numSources; ++i) {
+		auto const cpu = opts.pin_workers ? (opts.first_cpu + i) % numCpus : -1;
+		sources.push_back(addFilter<ExternalSource>(h.get(), sourceStreams[i], cpu));
+	}
+
+	for (int stream = 0; stream < num_streams; ++stream) {
+		auto &s = h->streams[stream];
+		s.source = sources[stream % numSources];
+		s.sourcePin = stream / numSources;
+		s.probe = muxProbe;
+		s.probePin = stream;
+	}
+
+	return h;
+}
+
+// Completes a prepared handle: dasher, sink and one muxer per stream.
+static void bindHandle(lldpkg_handle* h, const StreamDesc* streams, const char* publish_url) {
+	auto const &opts = h->options;
+	auto const ctx = h->context;
+	auto const num_streams = (int)h->streams.size();
+	auto const seg_dur_in_ms = h->segDurInMs;
+	// an offline session is on-demand: a static MPD, nothing pruned
+	auto const live = !h->virtualClock;
+	auto const timeshift_buffer_depth_in_ms = live ? h->timeshiftInMs : 0;
+
+	lock_guard<mutex> topologyLock(*h->pipeMutex);
+
+	// the session timeline starts now, whenever the handle was prepared
+	h->initTimeIn180k = fractionToClock(h->clock->now());
+	for (int stream = 0; stream < num_streams; ++stream)
+		setShedPriority(h, h->streams[stream], streams[stream]);
+
+	// Build parameters
+	h->mp4Flags = ExactInputDur | SegNumStartsAtZero;
+	if(opts.segment_callback || startsWith(publish_url, "http")) {
+		h->mp4Flags = h->mp4Flags | FlushFragMemory;
+	} else {
+		// chunks only leave the muxers ahead of the segment end with FlushFragMemory
+		if (opts.ll_chunk_duration_in_ms > 0)
+			throw std::runtime_error("LL-DASH chunks require publishing over HTTP or to a segment callback. Aborting.");
+		h->segmentHoldInNs = seg_dur_in_ms * 1000000LL;
+		auto const prefix = Stream::AdaptiveStreamingCommon::getCommonPrefixVideo(0, Resolution(0, 0));
+		auto const subdir = prefix + "/";
+		if (!dirExists(subdir))
+			mkdir(subdir);
+	}
+
+	// Create Dasher
+	Modules::DasherConfig dashCfg {};
+	dashCfg.mpdName = format("%s.mpd", h->logger.name);
+	dashCfg.live = live;
+	dashCfg.forceRealDurations = true;
+	dashCfg.presignalNextSegment = live;
+	dashCfg.segDurationInMs = seg_dur_in_ms;
+	dashCfg.timeShiftBufferDepthInMs = timeshift_buffer_depth_in_ms;
+	dashCfg.initialOffsetInMs = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+	if (h->virtualClock && opts.start_time_in_ms)
+		dashCfg.initialOffsetInMs = opts.start_time_in_ms;
+	if (num_streams > 1)
+		for (int stream = 0; stream < num_streams; ++stream)
+			dashCfg.tileInfo.push_back({ 0, (int)streams[stream].objectX,
+				(int)streams[stream].objectY, (int)streams[stream].objectWidth,
+				(int)streams[stream].objectHeight, (int)streams[stream].totalWidth,
+				(int)streams[stream].totalHeight });
+	auto dasher = h->dasher = addFilter(h, "MPEG_DASH", &dashCfg);
+	
+	// Create sink
+	IFilter* sink = nullptr;
+	IFilter* prefixer = nullptr;
+	vector<IFilter*> httpSinks;
+	bool sharedSink = false;
+	if(opts.segment_callback) {
+		sink = addFilter<CallbackSink>(h, opts.segment_callback, opts.segment_userdata, h->publishLatency);
+		h->logger.logf(Info, "%s", "Pushing to the segment callback");
+	} else if(startsWith(publish_url, "http") && ctx) {
+		string origin, path;
+		splitUrl(publish_url, origin, path);
+		sink = getPublisher(ctx.get(), origin);
+		sharedSink = true;
+		if (!path.empty())
+			prefixer = addFilter<PathPrefixer>(h, 2, path);
+		h->logger.logf(Info, "Pushing to HTTP at \"%s\" over the connections of the context", publish_url);
+	} else if(startsWith(publish_url, "http")) {
+		if (opts.http_connections < 0 || opts.http_retry_count < 0)
+			throw std::runtime_error("Invalid HTTP connection parameters. Aborting.");
+		HttpOutputConfig sinkCfg {};
+		sinkCfg.url = publish_url;
+		sinkCfg.userAgent = "bin2dash";
+		sinkCfg.maxConnectFailCount = opts.http_retry_count;
+		// one HttpSink per persistent connection
+		for (int i = 0; i < std::max(1, opts.http_connections); ++i)
+			httpSinks.push_back(addFilter(h, "HttpSink", &sinkCfg));
+		if (httpSinks.size() > 1)
+			sink = addFilter<PublishRouter>(h, (int)httpSinks.size());
+		else
+			sink = httpSinks[0];
+		h->logger.logf(Info, "Pushing to HTTP at \"%s\" over %d connection(s)", publish_url, (int)httpSinks.size());
+	} else if (opts.file_output == VRTFileWriteBehind) {
+		auto const directory = asDirectory(publish_url);
+		auto const retentionInMs = timeshift_buffer_depth_in_ms > 0 ? (int64_t)timeshift_buffer_depth_in_ms + 2 * seg_dur_in_ms : 0;
+		auto clock = h->clock;
+		h->fileWriter = make_shared<FileWriter>(directory, (FileWriter::Sync)opts.fsync_policy, retentionInMs,
+			[clock]() { return fractionToClock(clock->now()) * 1000 / IClock::Rate; },
+			[h](string const& msg) { h->logger.logf(Error, "[FileWriter] %s", msg.c_str()); },
+			FileMaxPendingBytes);
+		sink = addFilter<WriteBehindSink>(h, h->fileWriter);
+		h->logger.logf(Info, "Pushing to filesystem at \"%s\" from an I/O thread", publish_url);
+	} else if (opts.file_output == VRTFileDirect) {
+		FileSystemSinkConfig sinkCfg {};
+		sinkCfg.directory = publish_url;
+		sink = addFilter(h, "FileSystemSink", &sinkCfg);
+		h->logger.logf(Info, "Pushing to filesystem at \"%s\"", publish_url);
+	} else {
+		throw std::runtime_error(format("Invalid file output mode (%s). Aborting.", opts.file_output).c_str());
+	}
+
+	auto const sinkProbe = h->sinkProbe;
+	link(h, dasher, 0, sinkProbe, 0);
+	link(h, dasher, 1, h->mpdRewriter, 0);
+	link(h, h->mpdRewriter, 0, sinkProbe, 1);
+	if (sharedSink) {
+		// the publisher inputs take the files and MPDs of all the handles
+		IFilter* from = sinkProbe;
+		if (prefixer) {
+			link(h, sinkProbe, 0, prefixer, 0);
+			link(h, sinkProbe, 1, prefixer, 1);
+			from = prefixer;
+		}
+		link(h, from, 0, sink, 0, true);
+		link(h, from, 1, sink, 1, true);
+	} else {
+		link(h, sinkProbe, 0, sink, 0);
+		if (httpSinks.size() > 1) {
+			link(h, sinkProbe, 1, sink, 1);
+			for (int i = 0; i < (int)httpSinks.size(); ++i)
+				link(h, sink, i, httpSinks[i], 0);
 		} else {
-			FileSystemSinkConfig sinkCfg {};
-			sinkCfg.directory = publish_url;
-			sink = h->pipe->add("FileSystemSink", &sinkCfg);
-			h->logger.log(Info, format("Pushing to filesystem at \"%s\"", publish_url).c_str());
-		}
-		h->pipe->connect(dasher, sink);
-		h->pipe->connect(GetOutputPin(dasher, 1), sink, true);
-
-		for (int stream = 0; stream < num_streams; ++stream) {
-			auto source = h->pipe->addModule<ExternalSource>(h->streams[stream].fifo);
-
-			Mp4MuxConfig cfg {};
-			cfg.segmentDurationInMs = seg_dur_in_ms == 0 ? 1 : seg_dur_in_ms;
-			cfg.segmentPolicy = FragmentedSegment;
-			cfg.fragmentPolicy = OneFragmentPerFrame;
-			cfg.compatFlags = mp4Flags;
-			cfg.MP4_4CC = streams[stream].MP4_4CC;
-			auto muxer = h->pipe->add("GPACMuxMP4", &cfg);
-			h->pipe->connect(source, muxer);
-			h->pipe->connect(muxer, GetInputPin(dasher, stream));
+			link(h, sinkProbe, 1, sink, 0, true);
+		}
+	}
 
-			auto data = make_shared<DataRaw>(0);
-			auto meta = make_shared<MetadataPktVideo>();
-			meta->timeScale = Fraction(1000, 1);
-			data->setMetadata(meta);
-			data->set(PresentationTime{ });
-			data->set(DecodingTime{ });
-			data->set(CueFlags{});
-			h->streams[stream].fifo.write(data);
+	for (int stream = 0; stream < num_streams; ++stream)
+		connectStream(h, stream, streams[stream]);
+
+	if (ctx) {
+		lock_guard<mutex> lock(ctx->handlesMutex);
+		ctx->handles.push_back(h);
+	}
+	h->bound = true;
+}
+
+lldpkg_handle* lldpkg_create_ex(const char* name, LLDashPackagerMessageCallback onError, int level, int num_streams, const StreamDesc* streams, const char* publish_url, int seg_dur_in_ms, int timeshift_buffer_depth_in_ms, const LLDashPackagerOptions* options, uint64_t api_version) {
+	try {
+		auto const t0 = nowInNs();
+		auto h = prepareHandle(name, onError, level, num_streams, seg_dur_in_ms, timeshift_buffer_depth_in_ms, options, api_version);
+		h->startInNs = t0;
+		bindHandle(h.get(), streams, publish_url);
+		if (!h->context)
+			h->pipe->start();
+		h->startupInNs = nowInNs() - t0;
+
+		return h.release();
+	} catch (exception const& err) {
+		if (onError) {
+			char errbuf[128];
+			snprintf(errbuf, sizeof(errbuf), "[%s] exception caught: %s", __func__, err.what());
+			onError(errbuf, Level::Error);
 		}
+		return nullptr;
+	}
+}
 
-		h->pipe->start();
+lldpkg_handle* lldpkg_prepare(const char* name, LLDashPackagerMessageCallback onError, int level, int num_streams, int seg_dur_in_ms, int timeshift_buffer_depth_in_ms, const LLDashPackagerOptions* options, uint64_t api_version) {
+	try {
+		auto h = prepareHandle(name, onError, level, num_streams, seg_dur_in_ms, timeshift_buffer_depth_in_ms, options, api_version);
+		if (!h->context)
+			h->pipe->start();
+		h->logger.logf(Info, "Prepared for %d stream(s)", num_streams);
 
 		return h.release();
 	} catch (exception const& err) {
 		if (onError) {
 			char errbuf[128];
-			snprintf(errbuf, sizeof(errbuf), "[%s] exception caught: %s\n", __func__, err.what());
+			snprintf(errbuf, sizeof(errbuf), "[%s] exception caught: %s", __func__, err.what());
 			onError(errbuf, Level::Error);
 		}
 		return nullptr;
 	}
 }
 
+bool lldpkg_bind(lldpkg_handle* h, const StreamDesc* streams, const char* publish_url) {
+	try {
+		if (!h)
+			throw runtime_error("[lldpkg_bind] handle can't be NULL");
+		if (h->bound)
+			throw runtime_error("[lldpkg_bind] handle already bound");
+		if (!streams && h->streams.size())
+			throw runtime_error("[lldpkg_bind] streams can't be NULL");
+		if (h->error)
+			throw runtime_error("[lldpkg_bind] error state detected");
+
+		auto const t0 = nowInNs();
+		h->startInNs = t0;
+		bindHandle(h, streams, publish_url ? publish_url : "");
+		h->startupInNs = nowInNs() - t0;
+		return true;
+	} catch (exception const& err) {
+		if (h) {
+			h->error = true; // partially bound: can only be destroyed
+			h->logger.logf(Level::Error, "[%s] exception caught: %s", __func__, err.what());
+		}
+		return false;
+	}
+}
+
+
+lldpkg_context* lldpkg_context_create(LLDashPackagerMessageCallback onMessage, int level, const LLDashPackagerContextOptions* options, uint64_t api_version) {
+	try {
+		if (api_version != LLDASH_PACKAGER_API_VERSION)
+			throw std::runtime_error(format("Inconsistent API version between compilation (%s) and runtime (%s). Aborting.", LLDASH_PACKAGER_API_VERSION, api_version).c_str());
+
+		LLDashPackagerContextOptions opts {};
+		if (options)
+			opts = *options;
+		if (opts.http_connections < 0 || opts.http_retry_count < 0)
+			throw std::runtime_error("Invalid HTTP connection parameters. Aborting.");
+
+		auto shared = make_shared<SharedContext>();
+		shared->logger.name = "context";
+		shared->logger.maxLevel = (Level)level;
+		shared->logger.setLevel((Level)level);
+		shared->logger.onError = onMessage;
+		shared->logger.delivery = make_shared<LogDelivery>();
+		setGlobalLogger(shared->logger);
+
+		if (opts.http_connections)
+			shared->httpConnections = opts.http_connections;
+		shared->httpRetryCount = opts.http_retry_count;
+		if (opts.pool_buffers_per_class >= 0)
+			shared->pool = make_shared<BufferPool>(opts.pool_buffers_per_class ? opts.pool_buffers_per_class : 64);
+
+		shared->pipe = make_shared<Pipeline>(&shared->logger, false, Threading::OnePerModule);
+
+		// a pipeline error can't be attributed to a handle
+		auto ctx = shared.get();
+		shared->pipe->registerErrorCallback([ctx](const char *str) {
+			ctx->logger.logf(Info, "Error flag set on all the handles because \"%s\"", str);
+			lock_guard<mutex> lock(ctx->handlesMutex);
+			for (auto h : ctx->handles) {
+				h->error = true;
+				h->logger.logf(Error, "%s", str);
+			}
+			return false;
+		});
+		shared->pipe->start();
+
+		return new lldpkg_context { shared };
+	} catch (exception const& err) {
+		if (onMessage) {
+			char errbuf[128];
+			snprintf(errbuf, sizeof(errbuf), "[%s] exception caught: %s", __func__, err.what());
+			onMessage(errbuf, Level::Error);
+		}
+		return nullptr;
+	}
+}
+
+void lldpkg_context_destroy(lldpkg_context* ctx) {
+	delete ctx;
+}
 
 void lldpkg_destroy(lldpkg_handle* h, bool flush) {
+	if (!h)
+		return;
+
 	try {
-		if (flush) {
+		// don't let sleeping sources delay the shutdown
+		for (auto &stream : h->streams)
+			if (stream.notifier)
+				stream.notifier->notify();
+
+		if (flush && h->context) {
+			// the shared pipeline keeps running: only drain the ingest queues
+			auto const deadline = steady_clock::now() + seconds(5);
+			for (auto &stream : h->streams)
+				while (!stream.removed && stream.fifo.size() && steady_clock::now() < deadline)
+					this_thread::sleep_for(milliseconds(1));
+		} else if (flush) {
 			h->pipe->exitSync();
 			h->pipe->waitForEndOfStream();
 		}
@@ -204,42 +1392,484 @@ void lldpkg_destroy(lldpkg_handle* h, bool flush) {
 	} catch (exception const& err) {
 		fprintf(stderr, "[%s] failure: %s\n", __func__, err.what());
 		fflush(stderr);
-		if (h && h->errorCbk) {
-			char errbuf[128];
-			snprintf(errbuf, sizeof(errbuf), "[%s] exception caught: %s\n", __func__, err.what());
-			h->errorCbk(errbuf);
+		if (h)
+			h->logger.logf(Level::Error, "[%s] exception caught: %s", __func__, err.what());
+	}
+}
+
+static void checkStream(lldpkg_handle* h, int stream_index, const char* func) {
+	if (!h)
+		throw runtime_error(format("[%s] handle can't be NULL", func));
+	if (!h->bound)
+		throw runtime_error(format("[%s] handle not bound yet", func));
+	if (stream_index < 0 || stream_index >= (int)h->streams.size())
+		throw runtime_error(format("[%s] invalid stream_index", func));
+	if (h->streams[stream_index].removed)
+		throw runtime_error(format("[%s] stream %s was removed", func, stream_index));
+	if (h->error)
+		throw runtime_error(format("[%s] error state detected", func));
+}
+
+// When 'wake' is false, the caller is responsible for notifying the stream.
+static bool enqueue(lldpkg_handle::Stream &stream, IngestItem const& data, bool wake) {
+	if (!stream.fifo.tryPush(data)) {
+		switch (stream.overflowPolicy) {
+		case VRTOverflowDropOldest: {
+			IngestItem oldest;
+			do {
+				if (stream.fifo.tryPop(oldest))
+					stream.dropped++;
+			} while (!stream.fifo.tryPush(data));
+			break;
+		}
+		case VRTOverflowBlock: {
+			auto const deadline = chrono::steady_clock::now() + stream.blockTimeout;
+			do {
+				auto const now = chrono::steady_clock::now();
+				if (now >= deadline) {
+					stream.rejected++;
+					return false;
+				}
+				stream.space.wait(chrono::duration_cast<chrono::microseconds>(deadline - now));
+			} while (!stream.fifo.tryPush(data));
+			break;
+		}
+		default:
+			stream.rejected++;
+			return false;
+		}
+	}
+
+	stream.enqueued++;
+	auto const depth = stream.fifo.size();
+	auto hwm = stream.highWaterMark.load();
+	while (depth > hwm && !stream.highWaterMark.compare_exchange_weak(hwm, depth)) {}
+
+	if (wake)
+		stream.notifier->notify();
+	return true;
+}
+
+// Re-evaluated at most every 100 ms, by whichever producer gets there
+// first: one more priority class is shed while congested, one less once
+// the congestion clears.
+static void updateShedding(lldpkg_handle* h, int64_t now) {
+	auto next = h->nextShedCheckInNs.load();
+	if (now < next || !h->nextShedCheckInNs.compare_exchange_strong(next, now + 100000000))
+		return;
+
+	bool congested = false;
+	auto const dashSince = h->dashPendingSinceInNs.load();
+	if (h->shedLagInNs && dashSince && now - dashSince >= h->shedLagInNs)
+		congested = true;
+	for (auto &stream : h->streams) {
+		if (stream.removed)
+			continue;
+		if (h->shedQueuePercent && stream.fifo.size() * 100 >= stream.fifo.capacity() * h->shedQueuePercent)
+			congested = true;
+		// only the lag beyond what the muxer holds by design counts
+		auto const since = stream.muxPendingSinceInNs.load();
+		auto const holdInNs = std::max(h->segmentHoldInNs, rescale(stream.fragmentDurIn180k, IClock::Rate, 1000000000));
+		if (h->shedLagInNs && since && now - since >= h->shedLagInNs + holdInNs)
+			congested = true;
+	}
+
+	auto const level = h->shedLevel.load();
+	auto const maxPriority = h->maxShedPriority.load();
+	if (congested && level < maxPriority) {
+		h->shedLevel = level + 1;
+		h->logger.logf(Warning, "Congestion: shedding the streams with priority %d and above", maxPriority - level);
+	} else if (!congested && level > 0) {
+		h->shedLevel = level - 1;
+		if (level == 1)
+			h->logger.logf(Info, "%s", "Congestion cleared: load shedding stopped");
+		else
+			h->logger.logf(Info, "Congestion easing: shedding the streams with priority %d and above", maxPriority - level + 2);
+	}
+}
+
+// Stamps 'data' and queues it. 'callTimeInNs' is when the API call started, for the push latency.
+// Timestamps read from the session clock ('clockStamped') are made strictly increasing in queueing order.
+static int queueData(lldpkg_handle* h, int stream_index, shared_ptr<DataRaw> data, int64_t ptsIn180k, int64_t dtsIn180k, bool keyframe, bool clockStamped, int64_t callTimeInNs, bool wake = true) {
+	auto &stream = h->streams[stream_index];
+	lock_guard<mutex> lock(stream.producer);
+
+	if (clockStamped && dtsIn180k <= stream.lastDtsIn180k)
+		ptsIn180k = dtsIn180k = stream.lastDtsIn180k + 1;
+	stream.lastDtsIn180k = dtsIn180k;
+
+	if (h->shedQueuePercent || h->shedLagInNs) {
+		updateShedding(h, callTimeInNs);
+		auto const shed = stream.shedPriority > 0 && stream.shedPriority > h->maxShedPriority - h->shedLevel;
+		if (shed || (stream.shedding && !keyframe)) {
+			stream.shedding = true;
+			stream.shed++;
+			return VRTPushOk;
 		}
+		stream.shedding = false;
+	}
+
+	auto newFragment = keyframe;
+	if (keyframe && stream.aggregates() && stream.framesInFragment > 0) {
+		auto const full = stream.fragmentFrames > 1 && stream.framesInFragment >= stream.fragmentFrames;
+		auto const expired = stream.fragmentDurationIn180k > 0 && dtsIn180k - stream.fragmentStartIn180k >= stream.fragmentDurationIn180k;
+		newFragment = full || expired;
+	}
+
+	data->set(PresentationTime { ptsIn180k });
+	data->set(DecodingTime { dtsIn180k });
+	CueFlags cueFlags {};
+	cueFlags.keyframe = newFragment;
+	data->set(cueFlags);
+
+	auto const size = data->data().len;
+	if (!enqueue(stream, { data, nowInNs() }, wake)) {
+		h->logger.logf(Level::Debug, "[%s] queue full for stream %d, buffer refused", __func__, stream_index);
+		return VRTPushQueueFull;
+	}
+	if (newFragment) {
+		if (stream.framesInFragment > 0)
+			stream.fragmentDurIn180k = dtsIn180k - stream.fragmentStartIn180k;
+		stream.framesInFragment = 0;
+		stream.fragmentStartIn180k = dtsIn180k;
 	}
+	stream.framesInFragment++;
+	stream.bytes += size;
+	stream.pushLatency.record(nowInNs() - callTimeInNs);
+	return VRTPushOk;
+}
+
+static int64_t sessionTimeIn180k(lldpkg_handle* h) {
+	return fractionToClock(h->clock->now()) - h->initTimeIn180k;
+}
+
+// Timeline from the session clock: every frame is a keyframe.
+static int pushData(lldpkg_handle* h, int stream_index, shared_ptr<DataRaw> data, int64_t callTimeInNs) {
+	auto const timeIn180k = sessionTimeIn180k(h);
+	h->streams[stream_index].timeIn180k = timeIn180k;
+	return queueData(h, stream_index, data, timeIn180k, timeIn180k, true, true, callTimeInNs);
 }
 
 bool lldpkg_push_buffer(lldpkg_handle* h, int stream_index, const uint8_t * buffer, const size_t bufferSize) {
+	return lldpkg_try_push_buffer(h, stream_index, buffer, bufferSize) == VRTPushOk;
+}
+
+int lldpkg_try_push_buffer(lldpkg_handle* h, int stream_index, const uint8_t * buffer, const size_t bufferSize) {
+	auto const callTimeInNs = nowInNs();
 	try {
-		if (!h)
-			throw runtime_error("[lldpkg_push_buffer] handle can't be NULL");
+		checkStream(h, stream_index, __func__);
 		if (!buffer)
-			throw runtime_error("[lldpkg_push_buffer] buffer can't be NULL");
-		if (stream_index < 0 || stream_index >= (int)h->streams.size())
-			throw runtime_error("[lldpkg_push_buffer] invalid stream_index");
+			throw runtime_error("[lldpkg_try_push_buffer] buffer can't be NULL");
+
+		auto data = copyData(h, buffer, bufferSize);
+		return pushData(h, stream_index, data, callTimeInNs);
+	} catch (exception const& err) {
+		if (h)
+			h->logger.logf(Level::Error, "[%s] exception caught: %s", __func__, err.what());
+		return VRTPushError;
+	}
+}
+
+// Maps caller timestamps to the session timeline, in 180kHz.
+static void toClock(lldpkg_handle* h, const LLDashPackagerFrameInfo* info, int64_t &ptsIn180k, int64_t &dtsIn180k) {
+	if (info->dts > info->pts)
+		throw runtime_error("dts can't be greater than pts");
+
+	auto origin = lldpkg_handle::NoOrigin;
+	if (!h->originTimestamp.compare_exchange_strong(origin, info->dts) && info->dts < origin)
+		throw runtime_error("dts is before the start of the session");
+	origin = h->originTimestamp;
+
+	ptsIn180k = rescale(info->pts - origin, h->timescale, IClock::Rate);
+	dtsIn180k = rescale(info->dts - origin, h->timescale, IClock::Rate);
+}
+
+int lldpkg_push_frame(lldpkg_handle* h, int stream_index, const uint8_t * buffer, const size_t bufferSize, const LLDashPackagerFrameInfo* info) {
+	auto const callTimeInNs = nowInNs();
+	try {
+		checkStream(h, stream_index, __func__);
+		if (!buffer)
+			throw runtime_error("[lldpkg_push_frame] buffer can't be NULL");
+		if (!info)
+			throw runtime_error("[lldpkg_push_frame] info can't be NULL");
+
+		int64_t ptsIn180k, dtsIn180k;
+		toClock(h, info, ptsIn180k, dtsIn180k);
+		h->streams[stream_index].timeIn180k = ptsIn180k + rescale(info->duration, h->timescale, IClock::Rate);
+
+		auto data = copyData(h, buffer, bufferSize);
+		return queueData(h, stream_index, data, ptsIn180k, dtsIn180k, info->keyframe != 0, false, callTimeInNs);
+	} catch (exception const& err) {
+		if (h)
+			h->logger.logf(Level::Error, "[%s] exception caught: %s", __func__, err.what());
+		return VRTPushError;
+	}
+}
+
+int lldpkg_push_tiles(lldpkg_handle* h, const LLDashPackagerTile* tiles, int count, const LLDashPackagerFrameInfo* info) {
+	auto const callTimeInNs = nowInNs();
+	try {
+		if (!tiles || count <= 0)
+			throw runtime_error("[lldpkg_push_tiles] no tile");
+		for (int i = 0; i < count; ++i) {
+			checkStream(h, tiles[i].stream_index, __func__);
+			if (!tiles[i].buffer)
+				throw runtime_error("[lldpkg_push_tiles] buffer can't be NULL");
+			for (int j = 0; j < i; ++j)
+				if (tiles[j].stream_index == tiles[i].stream_index)
+					throw runtime_error("[lldpkg_push_tiles] duplicate stream_index");
+		}
+
+		// one clock read for the whole batch
+		int64_t ptsIn180k, dtsIn180k, timeIn180k;
+		bool keyframe = true;
+		if (info) {
+			toClock(h, info, ptsIn180k, dtsIn180k);
+			timeIn180k = ptsIn180k + rescale(info->duration, h->timescale, IClock::Rate);
+			keyframe = info->keyframe != 0;
+		} else {
+			ptsIn180k = dtsIn180k = timeIn180k = sessionTimeIn180k(h);
+		}
+
+		int res = VRTPushOk;
+		vector<Notifier*> toWake;
+		for (int i = 0; i < count; ++i) {
+			auto &stream = h->streams[tiles[i].stream_index];
+			stream.timeIn180k = timeIn180k;
+
+			auto data = copyData(h, tiles[i].buffer, tiles[i].size);
+			if (queueData(h, tiles[i].stream_index, data, ptsIn180k, dtsIn180k, keyframe, !info, callTimeInNs, false) != VRTPushOk)
+				res = VRTPushQueueFull;
+
+			// streams of a pooled ingest thread share their notifier
+			auto notifier = stream.notifier.get();
+			if (find(toWake.begin(), toWake.end(), notifier) == toWake.end())
+				toWake.push_back(notifier);
+		}
+		for (auto notifier : toWake)
+			notifier->notify();
+
+		return res;
+	} catch (exception const& err) {
+		if (h)
+			h->logger.logf(Level::Error, "[%s] exception caught: %s", __func__, err.what());
+		return VRTPushError;
+	}
+}
+
+bool lldpkg_push_buffer_multi(lldpkg_handle* h, const int* stream_indices, int count, const uint8_t * buffer, const size_t bufferSize) {
+	auto const callTimeInNs = nowInNs();
+	try {
+		if (!stream_indices || count <= 0)
+			throw runtime_error("[lldpkg_push_buffer_multi] no stream selected");
+		for (int i = 0; i < count; ++i)
+			checkStream(h, stream_indices[i], __func__);
+		if (!buffer)
+			throw runtime_error("[lldpkg_push_buffer_multi] buffer can't be NULL");
+
+		// one copy, shared by reference: each stream only gets its own timestamps
+		auto payload = copyData(h, buffer, bufferSize);
+
+		bool ok = true;
+		for (int i = 0; i < count; ++i) {
+			auto data = make_shared<DataRaw>(0);
+			data->buffer = payload->buffer;
+			if (pushData(h, stream_indices[i], data, callTimeInNs) != VRTPushOk)
+				ok = false;
+		}
+		return ok;
+	} catch (exception const& err) {
+		if (h)
+			h->logger.logf(Level::Error, "[%s] exception caught: %s", __func__, err.what());
+		return false;
+	}
+}
+
+bool lldpkg_push_buffer_nocopy(lldpkg_handle* h, int stream_index, const uint8_t * buffer, const size_t bufferSize, LLDashPackagerReleaseCallback release, void *userdata) {
+	auto const callTimeInNs = nowInNs();
+	// take ownership first so that the caller gets its memory back on every failure path
+	auto ownedBuffer = make_shared<ExternalBuffer>(buffer, bufferSize, release, userdata);
+	try {
+		checkStream(h, stream_index, __func__);
+		if (!buffer)
+			throw runtime_error("[lldpkg_push_buffer_nocopy] buffer can't be NULL");
+
+		auto data = make_shared<DataRaw>(0);
+		data->buffer = ownedBuffer;
+		ownedBuffer.reset();
+		return pushData(h, stream_index, data, callTimeInNs) == VRTPushOk;
+	} catch (exception const& err) {
+		if (h)
+			h->logger.logf(Level::Error, "[%s] exception caught: %s", __func__, err.what());
+		return false;
+	}
+}
+
+uint8_t* lldpkg_lease_buffer(lldpkg_handle* h, int stream_index, const size_t bufferSize) {
+	try {
+		checkStream(h, stream_index, __func__);
+
+		auto &stream = h->streams[stream_index];
+		auto data = allocData(h, bufferSize);
+		auto const ptr = data->buffer->data().ptr;
+		lock_guard<mutex> lock(stream.producer);
+		if (stream.lease)
+			throw runtime_error("[lldpkg_lease_buffer] a buffer is already leased for this stream");
+		stream.lease = move(data);
+		return ptr;
+	} catch (exception const& err) {
+		if (h)
+			h->logger.logf(Level::Error, "[%s] exception caught: %s", __func__, err.what());
+		return nullptr;
+	}
+}
+
+bool lldpkg_commit_buffer(lldpkg_handle* h, int stream_index, const size_t bufferSize) {
+	auto const callTimeInNs = nowInNs();
+	try {
+		checkStream(h, stream_index, __func__);
+
+		auto &stream = h->streams[stream_index];
+		shared_ptr<DataRaw> data;
+		{
+			lock_guard<mutex> lock(stream.producer);
+			data = move(stream.lease);
+		}
+		if (!data)
+			throw runtime_error("[lldpkg_commit_buffer] no buffer leased for this stream");
+		if (bufferSize > data->buffer->data().len)
+			throw runtime_error("[lldpkg_commit_buffer] size exceeds the leased buffer");
+		if (bufferSize < data->buffer->data().len)
+			data->buffer->resize(bufferSize);
+		return pushData(h, stream_index, data, callTimeInNs) == VRTPushOk;
+	} catch (exception const& err) {
+		if (h)
+			h->logger.logf(Level::Error, "[%s] exception caught: %s", __func__, err.what());
+		return false;
+	}
+}
+
+int lldpkg_add_stream(lldpkg_handle* h, const StreamDesc* desc, const LLDashPackagerStreamOptions* options) {
+	try {
+		if (!h)
+			throw runtime_error("[lldpkg_add_stream] handle can't be NULL");
+		if (!desc)
+			throw runtime_error("[lldpkg_add_stream] desc can't be NULL");
+		if (!h->bound)
+			throw runtime_error("[lldpkg_add_stream] handle not bound yet");
 		if (h->error)
-			throw runtime_error("[lldpkg_push_buffer] error state detected");
-		h->streams[stream_index].timeIn180k = fractionToClock(g_SystemClock->now()) - h->streams[stream_index].initTimeIn180k;
-
-		auto data = make_shared<DataRaw>(bufferSize);
-		memcpy(data->buffer->data().ptr, buffer, bufferSize);
-		data->set(PresentationTime { h->streams[stream_index].timeIn180k });
-		data->set(DecodingTime { h->streams[stream_index].timeIn180k });
-		CueFlags cueFlags {};
-		cueFlags.keyframe = true;
-		data->set(cueFlags);
-		h->streams[stream_index].fifo.write(data);
+			throw runtime_error("[lldpkg_add_stream] error state detected");
+
+		LLDashPackagerStreamOptions opts {};
+		if (options)
+			opts = *options;
+
+		lock_guard<mutex> lock(*h->pipeMutex);
+		auto const index = (int)h->streams.size();
+		checkStreamOptions(opts, index);
+		auto &stream = h->streams.emplace_back(opts, true);
+		setShedPriority(h, stream, *desc);
+		stream.notifier = makeNotifier(h);
+
+		auto const numModules = h->modules.size(), numLinks = h->links.size();
+		auto const dasherInput = h->nextDasherInput;
+		try {
+			stream.source = addFilter<ExternalSource>(h, vector<lldpkg_handle::Stream*>{ &stream }, -1);
+			stream.probe = addFilter<StageProbe>(h, 1, [h, index](int, Data const& data) {
+				onFragment(h, index, data);
+			});
+			stream.ownsBranch = true;
+			connectStream(h, index, *desc);
+		} catch (exception const&) {
+			// the slot stays, detached: indices are never reused
+			rollback(h, numModules, numLinks);
+			if (h->nextDasherInput != dasherInput) {
+				lock_guard<mutex> lock(h->mpdMutex);
+				h->removedDasherInputs.push_back(dasherInput);
+			}
+			throw;
+		}
+		{
+			lock_guard<mutex> lock(h->mpdMutex);
+			h->addedSrds[stream.dasherInput] = format("0,%s,%s,%s,%s,%s,%s", desc->objectX, desc->objectY,
+				desc->objectWidth, desc->objectHeight, desc->totalWidth, desc->totalHeight);
+		}
+		stream.removed = false;
+
+		h->logger.logf(Info, "Stream %d added", index);
+		return index;
+	} catch (exception const& err) {
+		if (h)
+			h->logger.logf(Level::Error, "[%s] exception caught: %s", __func__, err.what());
+		return -1;
+	}
+}
+
+bool lldpkg_remove_stream(lldpkg_handle* h, int stream_index) {
+	try {
+		checkStream(h, stream_index, __func__);
+
+		lock_guard<mutex> lock(*h->pipeMutex);
+		auto &stream = h->streams[stream_index];
+		if (stream.removed.exchange(true))
+			throw runtime_error("[lldpkg_remove_stream] stream already removed");
+		stream.notifier->notify();
+
+		unlink(h, stream.probe, stream.probePin, h->dasher, stream.dasherInput);
+		unlink(h, stream.muxer, 0, stream.probe, stream.probePin);
+		unlink(h, stream.source, stream.sourcePin, stream.muxer, 0);
+		if (stream.archive) {
+			unlink(h, stream.muxer, 0, stream.archive, 0);
+			removeFilter(h, stream.archive);
+			h->archiveWriter->close(archiveName(h, stream_index));
+		}
+		removeFilter(h, stream.muxer);
+		if (stream.ownsBranch) {
+			removeFilter(h, stream.probe);
+			removeFilter(h, stream.source);
+		}
+
+		// the Stream itself stays: producers may still hold its index
+		IngestItem item;
+		while (stream.fifo.tryPop(item)) {}
+
+		{
+			lock_guard<mutex> lock(h->mpdMutex);
+			h->removedDasherInputs.push_back(stream.dasherInput);
+			h->addedSrds.erase(stream.dasherInput);
+		}
 
+		h->logger.logf(Info, "Stream %d removed", stream_index);
 		return true;
 	} catch (exception const& err) {
-		h->logger.log(Level::Error, format("[%s] exception caught: %s\n", __func__, err.what()).c_str());
+		if (h)
+			h->logger.logf(Level::Error, "[%s] exception caught: %s", __func__, err.what());
 		return false;
 	}
 }
 
+bool lldpkg_advance_clock(lldpkg_handle* h, int64_t time, int timescale) {
+	try {
+		if (!h)
+			throw runtime_error("[lldpkg_advance_clock] handle can't be NULL");
+		if (!h->virtualClock)
+			throw runtime_error("[lldpkg_advance_clock] the session doesn't use a virtual clock");
+		if (timescale <= 0)
+			throw runtime_error("[lldpkg_advance_clock] invalid timescale");
+
+		auto const timeIn180k = rescale(time, timescale, IClock::Rate);
+		auto current = h->virtualClock->timeIn180k.load();
+		do {
+			if (timeIn180k < current)
+				throw runtime_error("[lldpkg_advance_clock] the clock can't go backwards");
+		} while (!h->virtualClock->timeIn180k.compare_exchange_weak(current, timeIn180k));
+		return true;
+	} catch (exception const& err) {
+		if (h)
+			h->logger.logf(Level::Error, "[%s] exception caught: %s", __func__, err.what());
+		return false;
+	}
+}
 
 int64_t lldpkg_get_media_time(lldpkg_handle* h, int stream_index, int timescale) {
 	try {
@@ -250,11 +1880,109 @@ int64_t lldpkg_get_media_time(lldpkg_handle* h, int stream_index, int timescale)
 
 		return rescale(h->streams[stream_index].timeIn180k, IClock::Rate, timescale);
 	} catch (exception const& err) {
-		h->logger.log(Level::Error, format("[%s] exception caught: %s\n", __func__, err.what()).c_str());
+		if (h)
+			h->logger.logf(Level::Error, "[%s] exception caught: %s", __func__, err.what());
 		return -1;
 	}
 }
 
+bool lldpkg_get_queue_stats(lldpkg_handle* h, int stream_index, LLDashPackagerQueueStats* stats) {
+	try {
+		if (!h)
+			throw runtime_error("[lldpkg_get_queue_stats] handle can't be NULL");
+		if (stream_index < 0 || stream_index >= (int)h->streams.size())
+			throw runtime_error("[lldpkg_get_queue_stats] invalid stream_index");
+		if (!stats)
+			throw runtime_error("[lldpkg_get_queue_stats] stats can't be NULL");
+
+		auto const &stream = h->streams[stream_index];
+		stats->enqueued = stream.enqueued;
+		stats->dropped = stream.dropped;
+		stats->rejected = stream.rejected;
+		stats->shed = stream.shed;
+		stats->depth = (uint32_t)stream.fifo.size();
+		stats->high_water_mark = (uint32_t)stream.highWaterMark;
+		stats->capacity = (uint32_t)stream.fifo.capacity();
+		return true;
+	} catch (exception const& err) {
+		if (h)
+			h->logger.logf(Level::Error, "[%s] exception caught: %s", __func__, err.what());
+		return false;
+	}
+}
+
+static LLDashPackagerLatency toLatency(LatencyHistogram::Summary const& s) {
+	return { s.count, s.p50, s.p90, s.p99, s.max };
+}
+
+bool lldpkg_get_stats(lldpkg_handle* h, int stream_index, LLDashPackagerStats* stats) {
+	try {
+		if (!h)
+			throw runtime_error("[lldpkg_get_stats] handle can't be NULL");
+		if (stream_index < -1 || stream_index >= (int)h->streams.size())
+			throw runtime_error("[lldpkg_get_stats] invalid stream_index");
+		if (!stats)
+			throw runtime_error("[lldpkg_get_stats] stats can't be NULL");
+
+		*stats = {};
+		if (stream_index == -1) {
+			for (auto const &stream : h->streams) {
+				stats->frames += stream.enqueued;
+				stats->bytes += stream.bytes;
+				stats->fragments += stream.fragments;
+				stats->fragment_bytes += stream.fragmentBytes;
+			}
+			stats->dash = toLatency(h->dashLatency.collect());
+			stats->publish = toLatency(h->publishLatency.collect());
+			stats->end_to_end = toLatency(h->endToEndLatency.collect());
+			stats->published = h->published;
+			stats->published_bytes = h->publishedBytes;
+			stats->log_dropped = h->logger.dropped;
+			stats->shed_level = h->shedLevel;
+			stats->mpd_published = h->mpdPublished;
+			stats->mpd_bytes = h->mpdPublishedBytes;
+			stats->mpd_suppressed = h->mpdSuppressed;
+			if (h->fileWriter) {
+				stats->file_bytes = h->fileWriter->bytesWritten;
+				stats->file_write_calls = h->fileWriter->writeCalls;
+				stats->file_batches = h->fileWriter->batches;
+				stats->file_coalesced = h->fileWriter->coalesced;
+				stats->file_pending_bytes = std::max<int64_t>(0, h->fileWriter->pendingBytes);
+				stats->file_pruned = h->fileWriter->pruned;
+				stats->file_errors = h->fileWriter->errors;
+				stats->file_dropped = h->fileWriter->dropped;
+			}
+			stats->startup_ns = h->startupInNs;
+			if (h->firstSegmentInNs)
+				stats->first_segment_ns = h->firstSegmentInNs - h->startInNs;
+			if (h->archiveWriter) {
+				stats->archive_bytes = h->archiveWriter->bytesWritten;
+				stats->archive_pending_bytes = std::max<int64_t>(0, h->archiveWriter->pendingBytes);
+				stats->archive_dropped = h->archiveWriter->dropped;
+			}
+			if (h->pool) {
+				stats->pool_hits = h->pool->hits;
+				stats->pool_misses = h->pool->misses;
+				stats->pool_cached_bytes = h->pool->cachedBytes;
+			}
+		} else {
+			auto &stream = h->streams[stream_index];
+			stats->push = toLatency(stream.pushLatency.collect());
+			stats->queue = toLatency(stream.queueLatency.collect());
+			stats->mux = toLatency(stream.muxLatency.collect());
+			stats->frames = stream.enqueued;
+			stats->bytes = stream.bytes;
+			stats->fragments = stream.fragments;
+			stats->fragment_bytes = stream.fragmentBytes;
+		}
+		return true;
+	} catch (exception const& err) {
+		if (h)
+			h->logger.logf(Level::Error, "[%s] exception caught: %s", __func__, err.what());
+		return false;
+	}
+}
+
 
 const char *lldpkg_get_version() {
 #ifdef LLDASH_VERSION
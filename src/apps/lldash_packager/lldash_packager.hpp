@@ -40,13 +40,17 @@
  * Clients should compare this against the constant passed to
  * {@link lldpkg_create} to verify ABI compatibility at runtime.
  */
-const uint64_t LLDASH_PACKAGER_API_VERSION = 0x20250724;
+const uint64_t LLDASH_PACKAGER_API_VERSION = 0x20261017;
 
 extern "C" {
 
 /*! @brief Opaque handle representing a live‑streaming pipeline. */
 struct lldpkg_handle;
 
+/*! @brief Opaque process‑wide context shared by several handles, see
+ *  {@link lldpkg_context_create}. */
+struct lldpkg_context;
+
 /*! @brief Description of a single media stream inside the packager.
  *
  * All members are **inherited** from the MPEG‑DASH SRD (Segmented
@@ -79,9 +83,11 @@ enum LLDashPackagerMessageLevel {
 /*! @brief Callback type for user supplied log messages.
  *
  * The library will invoke this function on a background thread
- * whenever it has something to report. The callback must be fast and
- * non‑blocking; the library guarantees that it will not be called
- * concurrently with itself, but may be called from any thread.
+ * whenever it has something to report. Messages are delivered
+ * asynchronously from a single background thread of the session, so the
+ * callback is never called concurrently with itself and never stalls the
+ * media path. Messages emitted faster than they can be delivered are
+ * dropped and reported with a warning.
  *
  * @param msg   NULK‑terminated message string.
  * @param level Severity of the message – one of {@link LLDashPackagerMessageLevel}.
@@ -89,6 +95,356 @@ enum LLDashPackagerMessageLevel {
 typedef void (*LLDashPackagerMessageCallback)(const char *msg,
                                               int level);
 
+/*! @enum LLDashPackagerWaitStrategy
+ *  @brief How the ingest threads wait for pushed buffers.
+ */
+enum LLDashPackagerWaitStrategy {
+    VRTWaitBlocking      = 0, /**< Sleep until a push wakes the thread.   */
+    VRTWaitSpinThenBlock = 1, /**< Spin for a bounded time, then sleep.   */
+    VRTWaitBusySpin      = 2  /**< Never sleep. Only for dedicated cores. */
+};
+
+/*! @enum LLDashPackagerThreading
+ *  @brief How ingest threads are allocated to streams.
+ */
+enum LLDashPackagerThreading {
+    VRTThreadingOnePerStream = 0, /**< One ingest thread per stream.      */
+    VRTThreadingPooled       = 1  /**< A fixed pool of ingest threads
+                                       shared by all the streams.         */
+};
+
+/*! @enum LLDashPackagerClockMode
+ *  @brief Where the session time comes from.
+ */
+enum LLDashPackagerClockMode {
+    VRTClockSystem  = 0, /**< The wall clock: real-time live sessions.    */
+    VRTClockVirtual = 1  /**< Moved by {@link lldpkg_advance_clock} only:
+                              offline packaging at CPU/disk speed, with
+                              a reproducible timeline. The MPD is static
+                              and the timeshift window is ignored: the
+                              whole session stays available. It is
+                              complete once the handle is destroyed with
+                              a flush.                                    */
+};
+
+/*! @enum LLDashPackagerMpdUpdate
+ *  @brief When the MPD is published.
+ */
+enum LLDashPackagerMpdUpdate {
+    VRTMpdEverySegment = 0, /**< Each time the dasher produces it.        */
+    VRTMpdOnChange     = 1  /**< Only when its content changes, e.g. when
+                                 a stream is added or removed. Requires
+                                 SegmentTemplate numbering
+                                 (`seg_dur_in_ms` > 0), with which the
+                                 clients compute the segment URLs without
+                                 refreshing the MPD.                      */
+};
+
+/*! @enum LLDashPackagerFileOutput
+ *  @brief How the output is written when publishing to the filesystem.
+ */
+enum LLDashPackagerFileOutput {
+    VRTFileDirect      = 0, /**< Each chunk is written by the pipeline
+                                 thread. Files are never deleted.         */
+    VRTFileWriteBehind = 1  /**< A dedicated I/O thread batches and
+                                 coalesces the writes, and deletes the
+                                 media segments that have left the
+                                 timeshift window.                        */
+};
+
+/*! @enum LLDashPackagerFsync
+ *  @brief When written files are flushed to storage, with
+ *  VRTFileWriteBehind.
+ */
+enum LLDashPackagerFsync {
+    VRTFsyncNever     = 0, /**< Left to the OS.                           */
+    VRTFsyncOnClose   = 1, /**< When a file is complete.                  */
+    VRTFsyncEachBatch = 2  /**< Also after each batch of writes.          */
+};
+
+/*! @enum LLDashPackagerOverflowPolicy
+ *  @brief What a push does when the stream's ingest queue is full.
+ */
+enum LLDashPackagerOverflowPolicy {
+    VRTOverflowReject     = 0, /**< Refuse the new buffer.                 */
+    VRTOverflowDropOldest = 1, /**< Evict the oldest queued buffer, so the
+                                    freshest frame wins.                   */
+    VRTOverflowBlock      = 2  /**< Wait for room, up to a timeout.        */
+};
+
+/*! @enum LLDashPackagerPushResult
+ *  @brief Return codes of {@link lldpkg_try_push_buffer}.
+ */
+enum LLDashPackagerPushResult {
+    VRTPushOk        =  0, /**< The buffer was queued.                    */
+    VRTPushError     = -1, /**< Invalid argument or pipeline in error.    */
+    VRTPushQueueFull = -2  /**< Refused by the overflow policy.           */
+};
+
+/*! @brief Per‑stream creation parameters.
+ *
+ * A zero‑initialized structure selects the defaults.
+ */
+struct LLDashPackagerStreamOptions {
+    /** Ingest queue capacity in buffers. 0 selects the default (256). */
+    int queue_capacity;
+    /** One of {@link LLDashPackagerOverflowPolicy}. */
+    int overflow_policy;
+    /** Maximum wait with VRTOverflowBlock. 0 selects the default (1000). */
+    int block_timeout_in_ms;
+    /** Aggregate up to this many frames per fragment. 0 or 1 means one
+        fragment per frame, unless `fragment_duration_in_ms` is set. */
+    int fragment_frames;
+    /** Start a new fragment once this much media time is aggregated.
+        0 means no duration limit. */
+    int fragment_duration_in_ms;
+    /** Load shedding: 0 never sheds the stream. Under congestion, the
+        streams with the highest value are shed first. With
+        `LLDashPackagerOptions::shed_by_srd`, 0 selects a value from the
+        SRD position instead. */
+    int shed_priority;
+};
+
+/*! @brief Ingest queue counters of a stream, see
+ *  {@link lldpkg_get_queue_stats}.
+ */
+struct LLDashPackagerQueueStats {
+    uint64_t enqueued;        /**< Buffers accepted into the queue.       */
+    uint64_t dropped;         /**< Queued buffers evicted (drop‑oldest).  */
+    uint64_t rejected;        /**< Pushes refused because of a full queue. */
+    uint64_t shed;            /**< Pushes discarded by load shedding.     */
+    uint32_t depth;           /**< Buffers currently queued.              */
+    uint32_t high_water_mark; /**< Maximum depth observed.                */
+    uint32_t capacity;        /**< Queue capacity.                        */
+};
+
+/*! @brief Latency distribution of one pipeline stage, in nanoseconds. */
+struct LLDashPackagerLatency {
+    uint64_t count;  /**< Samples in the interval.                     */
+    uint64_t p50_ns;
+    uint64_t p90_ns;
+    uint64_t p99_ns;
+    uint64_t max_ns;
+};
+
+/*! @brief Pipeline statistics, see {@link lldpkg_get_stats}.
+ *
+ * Latencies cover the interval since the previous call for the same
+ * stream index. Counters are cumulative since creation.
+ */
+struct LLDashPackagerStats {
+    /** Per stream: duration of the push call. */
+    LLDashPackagerLatency push;
+    /** Per stream: from the push to the ingest thread taking the frame. */
+    LLDashPackagerLatency queue;
+    /** Per stream: from the ingest thread to the fragment leaving the
+        muxer. */
+    LLDashPackagerLatency mux;
+    /** Session: from a fragment leaving a muxer to the dasher output
+        reaching the sink. */
+    LLDashPackagerLatency dash;
+    /** Session: time spent in the segment callback. Only measured when a
+        segment callback is registered. */
+    LLDashPackagerLatency publish;
+
+    uint64_t frames;         /**< Frames accepted.                       */
+    uint64_t bytes;          /**< Payload bytes accepted.                */
+    uint64_t fragments;      /**< Fragments out of the muxer(s).         */
+    uint64_t fragment_bytes; /**< Bytes out of the muxer(s).             */
+    uint64_t published;      /**< Session: chunks and MPDs sent to the sink. */
+    uint64_t published_bytes;/**< Session: bytes sent to the sink.       */
+    uint64_t pool_hits;      /**< Session: payloads served by the pool.  */
+    uint64_t pool_misses;    /**< Session: payloads allocated on the heap. */
+    uint64_t pool_cached_bytes; /**< Session: memory kept by the pool.   */
+    uint64_t log_dropped;    /**< Session: log messages dropped because the logger was saturated. */
+    uint32_t shed_level;     /**< Session: shed priority classes, from the highest value, 0 when not congested. */
+    uint64_t mpd_published;  /**< Session: MPDs sent to the sink.         */
+    uint64_t mpd_bytes;      /**< Session: MPD bytes sent to the sink.    */
+    uint64_t mpd_suppressed; /**< Session: unchanged MPDs not sent (VRTMpdOnChange). */
+    uint64_t file_bytes;     /**< Session: bytes written to disk (VRTFileWriteBehind). */
+    uint64_t file_write_calls; /**< Session: write system calls (VRTFileWriteBehind). */
+    uint64_t file_batches;   /**< Session: batches of the I/O thread (VRTFileWriteBehind). */
+    uint64_t file_coalesced; /**< Session: chunks of superseded versions not written (VRTFileWriteBehind). */
+    uint64_t file_pending_bytes; /**< Session: bytes queued, not yet written (VRTFileWriteBehind). */
+    uint64_t file_pruned;    /**< Session: segments deleted after leaving the timeshift window (VRTFileWriteBehind). */
+    uint64_t file_errors;    /**< Session: failed file operations (VRTFileWriteBehind). */
+    uint64_t file_dropped;   /**< Session: chunks dropped because 256 MiB were already waiting for storage (VRTFileWriteBehind). */
+    uint64_t archive_bytes;  /**< Session: bytes written to the MP4 archives. */
+    uint64_t archive_pending_bytes; /**< Session: archive bytes queued, not yet written. */
+    uint64_t archive_dropped; /**< Session: archive fragments dropped because 256 MiB were already waiting for storage. */
+    /** Session: duration of {@link lldpkg_create_ex}, or of
+        {@link lldpkg_bind} for a prepared handle. */
+    uint64_t startup_ns;
+    /** Session: from the start of that call to the first media chunk
+        reaching the sink. 0 until then. */
+    uint64_t first_segment_ns;
+    /** Session: from the push of a frame to the first media chunk holding
+        it reaching the sink. */
+    LLDashPackagerLatency end_to_end;
+};
+
+/*! @enum LLDashPackagerSegmentKind
+ *  @brief What a {@link LLDashPackagerSegment} carries.
+ */
+enum LLDashPackagerSegmentKind {
+    VRTSegmentInit     = 0, /**< Initialization segment.                */
+    VRTSegmentMedia    = 1, /**< Media segment data (fragments).        */
+    VRTSegmentManifest = 2  /**< MPD update.                            */
+};
+
+/*! @brief A piece of published output, borrowed for the duration of a
+ *  {@link LLDashPackagerSegmentCallback} call.
+ *
+ * Files are delivered as they are produced: a media segment arrives
+ * fragment by fragment, the last piece having `eos` set.
+ */
+struct LLDashPackagerSegment {
+    const char *filename;  /**< Name relative to the session root.     */
+    const uint8_t *data;   /**< Valid only during the callback.        */
+    size_t size;
+    int kind;              /**< One of {@link LLDashPackagerSegmentKind}. */
+    int eos;               /**< Non‑zero on the last piece of the file. */
+};
+
+/*! @brief Callback type receiving the published output in‑process.
+ *
+ * Called from a single pipeline thread; it is on the publishing hot path
+ * and should return quickly. Copy the data if it must outlive the call.
+ */
+typedef void (*LLDashPackagerSegmentCallback)(const LLDashPackagerSegment *segment,
+                                              void *userdata);
+
+/*! @brief Caller‑supplied timing of a frame, see {@link lldpkg_push_frame}.
+ *
+ * Times are in the timescale given at creation
+ * ({@link LLDashPackagerOptions}::timescale).
+ */
+struct LLDashPackagerFrameInfo {
+    int64_t pts;      /**< Presentation timestamp.                      */
+    int64_t dts;      /**< Decoding timestamp, <= `pts`.                */
+    int64_t duration; /**< Frame duration. Sample durations in the file
+                           come from consecutive DTS; this value extends
+                           the media time reported for the last frame.  */
+    int keyframe;     /**< Non‑zero for random access points. Segments
+                           are only cut on keyframes.                   */
+};
+
+/*! @brief Optional creation parameters for {@link lldpkg_create_ex}.
+ *
+ * A zero‑initialized structure selects the defaults used by
+ * {@link lldpkg_create}.
+ */
+struct LLDashPackagerOptions {
+    /** One of {@link LLDashPackagerWaitStrategy}. */
+    int wait_strategy;
+    /** Spin iterations before sleeping with VRTWaitSpinThenBlock.
+        0 selects the default. */
+    int spin_count;
+    /** Array of `num_streams` per‑stream parameters, or `nullptr` for the
+        defaults. */
+    const LLDashPackagerStreamOptions* stream_options;
+    /** One of {@link LLDashPackagerThreading}. */
+    int threading;
+    /** Number of ingest threads with VRTThreadingPooled. 0 selects the
+        number of hardware threads. Never more than the stream count. */
+    int pool_size;
+    /** Non‑zero pins pool thread `i` to CPU `(first_cpu + i) % ncpus`.
+        Supported on Linux and Windows. */
+    int pin_workers;
+    /** First CPU used when `pin_workers` is set. */
+    int first_cpu;
+    /** When set, output is handed to this callback instead of being
+        written to `publish_url`, which is then ignored. */
+    LLDashPackagerSegmentCallback segment_callback;
+    /** Opaque pointer forwarded to `segment_callback`. */
+    void *segment_userdata;
+    /** Units per second of the times passed to {@link lldpkg_push_frame},
+        also used as the track timescale. 0 selects the default (1000). */
+    int timescale;
+    /** HTTP publishing: number of persistent connections. Above 1, files
+        are spread over the connections and uploaded concurrently; the MPD
+        gets a connection of its own. 0 selects the default (1). */
+    int http_connections;
+    /** HTTP publishing: connection failures tolerated before the pipeline
+        enters the error state. 0 keeps the default (fail on first). */
+    int http_retry_count;
+    /** Non‑zero enables LL‑DASH signaling: the expected duration of a
+        chunk, i.e. of a fragment: the frame interval by default, more
+        when `fragment_frames` or `fragment_duration_in_ms` aggregate
+        frames (use the longest over the streams). The MPD then advertises availabilityTimeOffset =
+        segment duration - chunk duration, so that clients request
+        segments while their chunks are still being pushed. Only for
+        HTTP publishing or a segment callback: files are only written
+        once complete, so creation fails with a filesystem output. */
+    int ll_chunk_duration_in_ms;
+    /** Payload buffer pool: free buffers kept per size class, so that
+        steady‑state pushes recycle memory instead of allocating it.
+        0 selects the default (16), a negative value disables the pool. */
+    int pool_buffers_per_class;
+    /** Upper bound on the streams of the session, counting those added
+        with {@link lldpkg_add_stream} and the removed ones, as stream
+        indices are never reused. 0 selects the default (256, or
+        `num_streams` if larger). */
+    int max_streams;
+    /** One of {@link LLDashPackagerClockMode}. */
+    int clock_mode;
+    /** With VRTClockVirtual: UTC time of the session start, in
+        milliseconds since the epoch, the timing reference of the MPD.
+        0 selects the wall clock at creation; set it for reproducible
+        output. */
+    int64_t start_time_in_ms;
+    /** Load shedding trigger: fill ratio of an ingest queue, in percent.
+        0 disables this trigger. */
+    int shed_queue_percent;
+    /** Load shedding trigger: age of the oldest frame not yet out of the
+        muxers and dasher, in milliseconds, beyond the time a muxer holds
+        a frame by design: its fragment duration and, for the filesystem
+        output, its segment duration. 0 disables this trigger. */
+    int shed_lag_in_ms;
+    /** Non‑zero derives the shed priority of the streams that have none
+        from their SRD position: the central tiles are never shed, the
+        peripheral ones first. */
+    int shed_by_srd;
+    /** One of {@link LLDashPackagerMpdUpdate}. */
+    int mpd_update;
+    /** When set, the handle joins this context instead of building its
+        own pipeline: see {@link lldpkg_context_create}. The pool and
+        HTTP settings of the context then replace `pool_buffers_per_class`,
+        `http_connections` and `http_retry_count`. */
+    lldpkg_context* context;
+    /** One of {@link LLDashPackagerFileOutput}. Only used when publishing
+        to the filesystem. With VRTFileWriteBehind and a non‑zero
+        `timeshift_buffer_depth_in_ms`, media segments are deleted two
+        segment durations after they leave the timeshift window. */
+    int file_output;
+    /** One of {@link LLDashPackagerFsync}, with VRTFileWriteBehind and
+        for the archives. */
+    int fsync_policy;
+    /** When set, each stream is also recorded into a single fragmented
+        MP4 file in this directory, `<name>-<stream_index>.mp4`, while
+        publishing goes on: the initialization segment followed by all the
+        fragments, as replayable as the concatenation of the published
+        segments. The fragments are shared with the publishing path and
+        written by a background thread in large sequential writes. */
+    const char* archive_path;
+};
+
+/*! @brief Creation parameters of a context, see
+ *  {@link lldpkg_context_create}. Zero‑initialize for the defaults.
+ */
+struct LLDashPackagerContextOptions {
+    /** Persistent HTTP connections per server, shared by all the handles
+        publishing to that server. 0 selects the default (4). */
+    int http_connections;
+    /** Connection failures tolerated before the pipeline enters the error
+        state. 0 keeps the default (fail on first). */
+    int http_retry_count;
+    /** Payload buffer pool shared by the handles: free buffers kept per
+        size class. 0 selects the default (64), a negative value disables
+        the pool. */
+    int pool_buffers_per_class;
+};
+
 /* --------------------------------------------------------------------------- *
  *  API functions
  * --------------------------------------------------------------------------- */
@@ -132,6 +488,108 @@ LLDPKG_EXPORT lldpkg_handle* lldpkg_create(
     int timeshift_buffer_depth_in_ms = 30000,
     uint64_t api_version = LLDASH_PACKAGER_API_VERSION);
 
+/*! @brief Create a new packager/streamer instance with extra options.
+ *
+ * Same as {@link lldpkg_create}, with additional tuning parameters.
+ *
+ * @param options             Optional creation parameters. `nullptr`
+ *                            selects the defaults.
+ *
+ * @return Pointer to a newly allocated {@link lldpkg_handle}, or `nullptr`
+ *         on error.
+ */
+LLDPKG_EXPORT lldpkg_handle* lldpkg_create_ex(
+    const char* name,
+    LLDashPackagerMessageCallback onError,
+    int level,
+    int num_streams,
+    const StreamDesc* streams,
+    const char *publish_url,
+    int seg_dur_in_ms,
+    int timeshift_buffer_depth_in_ms,
+    const LLDashPackagerOptions* options,
+    uint64_t api_version = LLDASH_PACKAGER_API_VERSION);
+
+/*! @brief Prepare a handle ahead of time, to be bound later.
+ *
+ * Does all the work of {@link lldpkg_create_ex} that doesn't depend on
+ * the stream descriptors nor on the publish URL: logger, buffer pool,
+ * pipeline and ingest threads are created and started, so that
+ * {@link lldpkg_bind} only has to build the dasher, the muxers and the
+ * sink. The handle can't be pushed to until it is bound. The session
+ * timeline starts at {@link lldpkg_bind}.
+ *
+ * @param num_streams  Number of streams the handle will be bound to.
+ *
+ * Other parameters as for {@link lldpkg_create_ex}.
+ *
+ * @return The prepared handle, or `nullptr` on error. Destroy it with
+ *         {@link lldpkg_destroy}, bound or not.
+ */
+LLDPKG_EXPORT lldpkg_handle* lldpkg_prepare(
+    const char* name,
+    LLDashPackagerMessageCallback onError,
+    int level,
+    int num_streams,
+    int seg_dur_in_ms,
+    int timeshift_buffer_depth_in_ms,
+    const LLDashPackagerOptions* options,
+    uint64_t api_version = LLDASH_PACKAGER_API_VERSION);
+
+/*! @brief Bind a prepared handle to its streams and destination.
+ *
+ * @param h           Handle returned by {@link lldpkg_prepare}.
+ * @param streams     Array of the `num_streams` passed to
+ *                    {@link lldpkg_prepare}. Copied.
+ * @param publish_url As for {@link lldpkg_create_ex}.
+ *
+ * @return `true` on success. On failure the handle can only be destroyed.
+ */
+LLDPKG_EXPORT bool lldpkg_bind(
+    lldpkg_handle* h,
+    const StreamDesc* streams,
+    const char* publish_url);
+
+/*! @brief Create a context to run many sessions in one process.
+ *
+ * Handles created with `LLDashPackagerOptions::context` set share a single
+ * log delivery thread, a payload pool, and one pool of persistent HTTP
+ * connections per server, so that the connection count no longer grows
+ * with the handles. Each handle still adds its own modules, and their
+ * threads, to the pipeline of the context: ingest sources (bounded with
+ * VRTThreadingPooled), muxers, probes, dasher and MPD rewriter. Files
+ * published over a shared connection keep the path of the handle's
+ * `publish_url`. The messages of a handle still go to its own callback;
+ * the context callback only gets the messages that can't be attributed to
+ * a handle. The context becomes the process‑wide logger: don't mix it
+ * with handles created without a context.
+ *
+ * A pipeline error, e.g. a failing shared connection, puts every handle of
+ * the context in the error state.
+ *
+ * @param onMessage   Callback for the messages of the context, or
+ *                    `nullptr` for stderr.
+ * @param level       Logging verbosity (see
+ *                    {@link LLDashPackagerMessageLevel}).
+ * @param options     Optional parameters. `nullptr` selects the defaults.
+ * @param api_version Optional API version to validate against.
+ *
+ * @return The context, or `nullptr` on error. Destroy it with
+ *         {@link lldpkg_context_destroy}.
+ */
+LLDPKG_EXPORT lldpkg_context* lldpkg_context_create(
+    LLDashPackagerMessageCallback onMessage,
+    int level,
+    const LLDashPackagerContextOptions* options,
+    uint64_t api_version = LLDASH_PACKAGER_API_VERSION);
+
+/*! @brief Release a context.
+ *
+ * The handles created from it may still be alive: the shared resources
+ * are freed with the last of them.
+ */
+LLDPKG_EXPORT void lldpkg_context_destroy(lldpkg_context* ctx);
+
 /*! @brief Destroy a previously created pipeline.
  *
  * Frees all internal resources.  The caller can optionally flush any
@@ -139,7 +597,9 @@ LLDPKG_EXPORT lldpkg_handle* lldpkg_create(
  *
  * @param h     Handle returned by {@link lldpkg_create}.
  * @param flush If `true`, the library will push remaining fragments to
- *              the destination (if any) before freeing memory.
+ *              the destination (if any) before freeing memory. With a
+ *              context, only the ingest queues are drained: the other
+ *              handles keep the shared pipeline running.
  */
 LLDPKG_EXPORT void lldpkg_destroy(lldpkg_handle* h, bool flush = false);
 
@@ -149,6 +609,13 @@ LLDPKG_EXPORT void lldpkg_destroy(lldpkg_handle* h, bool flush = false);
  * retains ownership and may immediately reuse or free the original
  * memory after this call returns.
  *
+ * All the push functions can be called concurrently from any number of
+ * threads. Pushes to different streams never wait for each other. Pushes
+ * to the same stream are timestamped and queued in a single order: the
+ * order in which they get hold of the stream. In that order, timestamps
+ * taken from the session clock are strictly increasing. A stream has at
+ * most one buffer leased at a time (see {@link lldpkg_lease_buffer}).
+ *
  * @param h            Handle returned by {@link lldpkg_create}.
  * @param stream_index Zero‑based index into the array passed to
  *                     {@link lldpkg_create}.  Must be < `num_streams`.
@@ -156,7 +623,8 @@ LLDPKG_EXPORT void lldpkg_destroy(lldpkg_handle* h, bool flush = false);
  * @param bufferSize   Size of the buffer in bytes.
  *
  * @return `true` if the push succeeded; `false` if the pipeline is in an
- *         error state and will not accept further input.
+ *         error state and will not accept further input, or if the buffer
+ *         was refused by the stream's overflow policy.
  */
 LLDPKG_EXPORT bool lldpkg_push_buffer(
     lldpkg_handle* h,
@@ -164,6 +632,184 @@ LLDPKG_EXPORT bool lldpkg_push_buffer(
     const uint8_t * buffer,
     const size_t bufferSize);
 
+/*! @brief Push a raw media buffer and report why it was not accepted.
+ *
+ * Same as {@link lldpkg_push_buffer}, but distinguishes a buffer refused
+ * by the stream's overflow policy from an error.
+ *
+ * @return One of {@link LLDashPackagerPushResult}.
+ */
+LLDPKG_EXPORT int lldpkg_try_push_buffer(
+    lldpkg_handle* h,
+    int stream_index,
+    const uint8_t * buffer,
+    const size_t bufferSize);
+
+/*! @brief Push a raw media buffer with caller‑supplied timing.
+ *
+ * Unlike {@link lldpkg_push_buffer}, which stamps frames with the wall
+ * clock at call time and flags all of them as keyframes, the timeline is
+ * taken from `info`. Timestamps are relative to the first DTS pushed on
+ * the session, whatever the stream, so frames of different streams with
+ * the same timestamps stay aligned. Do not mix both kinds of push on the
+ * same stream.
+ *
+ * @param h            Handle returned by {@link lldpkg_create}.
+ * @param stream_index Zero‑based index of the stream.
+ * @param buffer       Pointer to raw media data. Copied.
+ * @param bufferSize   Size of the buffer in bytes.
+ * @param info         Timing and keyframe flag of the frame.
+ *
+ * @return One of {@link LLDashPackagerPushResult}.
+ */
+LLDPKG_EXPORT int lldpkg_push_frame(
+    lldpkg_handle* h,
+    int stream_index,
+    const uint8_t * buffer,
+    const size_t bufferSize,
+    const LLDashPackagerFrameInfo* info);
+
+/*! @brief One tile of a {@link lldpkg_push_tiles} batch. */
+struct LLDashPackagerTile {
+    int stream_index;      /**< Zero‑based index of the stream.      */
+    const uint8_t *buffer; /**< Pointer to raw media data. Copied.   */
+    size_t size;           /**< Size of the buffer in bytes.         */
+};
+
+/*! @brief Push all the tiles of one capture instant at once.
+ *
+ * Every tile gets exactly the same timestamps, so all streams keep the
+ * same segment boundaries. Arguments are validated once, before anything
+ * is queued, and the ingest threads are woken once for the whole batch.
+ *
+ * @param h     Handle returned by {@link lldpkg_create}.
+ * @param tiles Array of `count` tiles, at most one per stream.
+ * @param count Number of entries in `tiles`.
+ * @param info  Timing of the capture instant, as for
+ *              {@link lldpkg_push_frame}; `nullptr` stamps the batch with
+ *              the wall clock, as {@link lldpkg_push_buffer} does.
+ *
+ * @return One of {@link LLDashPackagerPushResult}. VRTPushQueueFull means
+ *         that the overflow policy refused at least one tile; the other
+ *         tiles were queued.
+ */
+LLDPKG_EXPORT int lldpkg_push_tiles(
+    lldpkg_handle* h,
+    const LLDashPackagerTile* tiles,
+    int count,
+    const LLDashPackagerFrameInfo* info);
+
+/*! @brief Push the same media buffer to several streams.
+ *
+ * The payload is copied once and shared by all the selected streams,
+ * instead of once per {@link lldpkg_push_buffer} call.
+ *
+ * @param h              Handle returned by {@link lldpkg_create}.
+ * @param stream_indices Array of `count` zero‑based stream indices.
+ * @param count          Number of entries in `stream_indices`.
+ * @param buffer         Pointer to raw media data.
+ * @param bufferSize     Size of the buffer in bytes.
+ *
+ * @return `true` if every selected stream accepted the buffer; `false`
+ *         otherwise. Nothing is pushed when an index is invalid.
+ */
+LLDPKG_EXPORT bool lldpkg_push_buffer_multi(
+    lldpkg_handle* h,
+    const int* stream_indices,
+    int count,
+    const uint8_t * buffer,
+    const size_t bufferSize);
+
+/*! @brief Callback type used to give caller-owned memory back.
+ *
+ * Invoked exactly once for every buffer handed over with
+ * {@link lldpkg_push_buffer_nocopy}, as soon as the pipeline holds no
+ * more reference to it. This also happens when the push fails. It may be
+ * called from any pipeline thread and must not call back into the library.
+ *
+ * @param buffer   The pointer that was passed to the push call.
+ * @param userdata The opaque pointer that was passed to the push call.
+ */
+typedef void (*LLDashPackagerReleaseCallback)(const uint8_t *buffer,
+                                              void *userdata);
+
+/*! @brief Push a caller-owned media buffer without copying it.
+ *
+ * Same as {@link lldpkg_push_buffer}, but the library references `buffer`
+ * directly. The memory must stay valid and unmodified until `release` is
+ * invoked.
+ *
+ * @param h            Handle returned by {@link lldpkg_create}.
+ * @param stream_index Zero‑based index of the stream.
+ * @param buffer       Pointer to raw media data.
+ * @param bufferSize   Size of the buffer in bytes.
+ * @param release      Called once the library is done with `buffer`.
+ *                     May be `nullptr` if the memory outlives the handle.
+ * @param userdata     Opaque pointer forwarded to `release`.
+ *
+ * @return `true` if the push succeeded; `false` otherwise.
+ */
+LLDPKG_EXPORT bool lldpkg_push_buffer_nocopy(
+    lldpkg_handle* h,
+    int stream_index,
+    const uint8_t * buffer,
+    const size_t bufferSize,
+    LLDashPackagerReleaseCallback release,
+    void *userdata);
+
+/*! @brief Lease a pipeline-owned buffer to be filled in place.
+ *
+ * The returned memory is writable until it is handed back with
+ * {@link lldpkg_commit_buffer}. At most one lease is outstanding per
+ * stream: leasing again before the commit fails.
+ *
+ * @param h            Handle returned by {@link lldpkg_create}.
+ * @param stream_index Zero‑based index of the stream.
+ * @param bufferSize   Maximum number of bytes that will be written.
+ *
+ * @return Pointer to at least `bufferSize` writable bytes, or `nullptr`
+ *         on error, including when a buffer is already leased for this
+ *         stream.
+ */
+LLDPKG_EXPORT uint8_t* lldpkg_lease_buffer(
+    lldpkg_handle* h,
+    int stream_index,
+    const size_t bufferSize);
+
+/*! @brief Push the buffer previously leased for a stream.
+ *
+ * @param h            Handle returned by {@link lldpkg_create}.
+ * @param stream_index Zero‑based index of the stream.
+ * @param bufferSize   Number of bytes actually written. Must not exceed
+ *                     the leased size.
+ *
+ * @return `true` if the push succeeded; `false` otherwise. The lease is
+ *         consumed in both cases.
+ */
+LLDPKG_EXPORT bool lldpkg_commit_buffer(
+    lldpkg_handle* h,
+    int stream_index,
+    const size_t bufferSize);
+
+/*! @brief Move the virtual clock forward.
+ *
+ * Only for sessions created with VRTClockVirtual. Buffers pushed without
+ * timestamps (e.g. with {@link lldpkg_push_buffer}) are stamped with
+ * this time, so an archived capture is replayed by advancing the clock
+ * by the frame interval before each push, without sleeping.
+ *
+ * @param h         Handle returned by {@link lldpkg_create_ex}.
+ * @param time      New time since the session start, in `timescale`
+ *                  units. Must not be before the current time.
+ * @param timescale Units per second of `time`.
+ *
+ * @return `true` on success; `false` otherwise.
+ */
+LLDPKG_EXPORT bool lldpkg_advance_clock(
+    lldpkg_handle* h,
+    int64_t time,
+    int timescale);
+
 /*! @brief Retrieve the current media time for a stream.
  *
  * The returned value is expressed in the supplied `timescale` unit
@@ -180,6 +826,73 @@ LLDPKG_EXPORT int64_t lldpkg_get_media_time(
     int stream_index,
     int timescale);
 
+/*! @brief Read the ingest queue counters of a stream.
+ *
+ * Cheap enough to be polled periodically from any thread.
+ *
+ * @param h            Handle returned by {@link lldpkg_create}.
+ * @param stream_index Zero‑based index of the stream.
+ * @param stats        Filled on success.
+ *
+ * @return `true` on success; `false` on invalid arguments.
+ */
+LLDPKG_EXPORT bool lldpkg_get_queue_stats(
+    lldpkg_handle* h,
+    int stream_index,
+    LLDashPackagerQueueStats* stats);
+
+/*! @brief Read the latency histograms and throughput counters.
+ *
+ * Lock‑free and cheap enough to be polled every second. Per‑stream
+ * latencies are reset by each call, see {@link LLDashPackagerStats}.
+ *
+ * @param h            Handle returned by {@link lldpkg_create}.
+ * @param stream_index Zero‑based index of the stream, or -1 for the
+ *                     session: per‑stream fields are then summed (no
+ *                     latencies), and the session fields are filled.
+ * @param stats        Filled on success.
+ *
+ * @return `true` on success; `false` on invalid arguments.
+ */
+LLDPKG_EXPORT bool lldpkg_get_stats(
+    lldpkg_handle* h,
+    int stream_index,
+    LLDashPackagerStats* stats);
+
+/*! @brief Attach a new stream to a running session.
+ *
+ * The stream gets a dedicated ingest thread and muxer; the streams
+ * already running are not interrupted. It appears in the MPD at the next
+ * segment boundary, with the SRD of `desc`.
+ *
+ * @param h       Handle returned by {@link lldpkg_create}.
+ * @param desc    Description of the new stream. Copied.
+ * @param options Parameters of the new stream, or `nullptr` for the
+ *                defaults.
+ *
+ * @return The index of the new stream, or -1 on failure (e.g. when
+ *         {@link LLDashPackagerOptions::max_streams} is reached).
+ */
+LLDPKG_EXPORT int lldpkg_add_stream(
+    lldpkg_handle* h,
+    const StreamDesc* desc,
+    const LLDashPackagerStreamOptions* options);
+
+/*! @brief Detach a stream from a running session.
+ *
+ * Pushes to the stream fail from then on and its queued buffers are
+ * discarded. Its Representation disappears from the MPD at the next
+ * segment boundary. The index is not reused.
+ *
+ * @param h            Handle returned by {@link lldpkg_create}.
+ * @param stream_index Zero‑based index of the stream.
+ *
+ * @return `true` if the stream was removed; `false` otherwise.
+ */
+LLDPKG_EXPORT bool lldpkg_remove_stream(
+    lldpkg_handle* h,
+    int stream_index);
+
 /*! @brief Return the library version string.
  *
  * The format is typically “MAJOR.MINOR.PATCH” and may include a
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Wakes a consumer thread when a producer has queued some work.
+// The producer side is a single atomic store unless someone is blocked.
+struct Notifier {
+	enum Strategy {
+		Blocking = 0,      // sleep on a condition variable until notified
+		SpinThenBlock = 1, // spin for 'spinCount' iterations, then block
+		BusySpin = 2,      // never sleep: for threads owning a dedicated core
+	};
+
+	void notify() {
+		pending = true;
+		if (waiters) {
+			std::lock_guard<std::mutex> lock(mutex);
+			cv.notify_all();
+		}
+	}
+
+	// Returns when notified or when 'timeout' expires, whichever comes first.
+	// The timeout only bounds how long a shutdown request may go unnoticed.
+	void wait(std::chrono::microseconds timeout) {
+		if (pending.exchange(false))
+			return;
+
+		if (strategy != Blocking) {
+			auto const deadline = std::chrono::steady_clock::now() + timeout;
+			for (int i = 0; strategy == BusySpin || i < spinCount; ++i) {
+				cpuRelax();
+				if (pending.exchange(false))
+					return;
+				if ((i & 1023) == 1023 && std::chrono::steady_clock::now() >= deadline)
+					return;
+			}
+		}
+
+		std::unique_lock<std::mutex> lock(mutex);
+		waiters++;
+		cv.wait_for(lock, timeout, [&]() {
+			return pending.load();
+		});
+		waiters--;
+		pending = false;
+	}
+
+	Strategy strategy = Blocking;
+	int spinCount = 4000;
+
+private:
+	static void cpuRelax() {
+#if defined(__i386__) || defined(__x86_64__)
+		__builtin_ia32_pause();
+#elif defined(__aarch64__)
+		asm volatile("yield");
+#else
+		std::this_thread::yield();
+#endif
+	}
+
+	std::atomic<bool> pending { false };
+	std::atomic<int> waiters { 0 };
+	std::mutex mutex;
+	std::condition_variable cv;
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+inline int64_t nowInNs() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Lock-free latency histogram with log-linear buckets: 4 sub-buckets per
+// power of two, i.e. a relative error below 25%. Recording is a couple of
+// relaxed atomic increments, so it is safe on the media path.
+struct LatencyHistogram {
+	struct Summary {
+		uint64_t count, p50, p90, p99, max;
+	};
+
+	void record(int64_t ns) {
+		auto const v = ns > 0 ? (uint64_t)ns : 0;
+		buckets[bucketOf(v)].fetch_add(1, std::memory_order_relaxed);
+		auto m = maxValue.load(std::memory_order_relaxed);
+		while (v > m && !maxValue.compare_exchange_weak(m, v, std::memory_order_relaxed)) {}
+	}
+
+	// Summarizes the values recorded since the previous call, and starts a new interval.
+	Summary collect() {
+		uint64_t snapshot[NumBuckets];
+		uint64_t count = 0;
+		for (int i = 0; i < NumBuckets; ++i) {
+			snapshot[i] = buckets[i].exchange(0, std::memory_order_relaxed);
+			count += snapshot[i];
+		}
+
+		Summary s {};
+		s.count = count;
+		s.max = maxValue.exchange(0, std::memory_order_relaxed);
+		s.p50 = std::min(s.max, percentile(snapshot, count, 50));
+		s.p90 = std::min(s.max, percentile(snapshot, count, 90));
+		s.p99 = std::min(s.max, percentile(snapshot, count, 99));
+		return s;
+	}
+
+private:
+	static constexpr int NumBuckets = 4 * 63;
+
+	static int bucketOf(uint64_t v) {
+		if (v < 4)
+			return (int)v;
+		int msb = 63;
+		while (!(v >> msb))
+			msb--;
+		return 4 * (msb - 1) + (int)((v >> (msb - 2)) & 3);
+	}
+
+	// Upper bound of the bucket.
+	static uint64_t valueOf(int bucket) {
+		if (bucket < 4)
+			return (uint64_t)bucket;
+		auto const msb = bucket / 4 + 1;
+		auto const sub = (uint64_t)(bucket % 4);
+		return ((4 + sub + 1) << (msb - 2)) - 1;
+	}
+
+	static uint64_t percentile(uint64_t const* snapshot, uint64_t count, int pct) {
+		if (!count)
+			return 0;
+		auto const rank = (count * pct + 99) / 100;
+		uint64_t acc = 0;
+		for (int i = 0; i < NumBuckets; ++i) {
+			acc += snapshot[i];
+			if (acc >= rank)
+				return valueOf(i);
+		}
+		return valueOf(NumBuckets - 1);
+	}
+
+	std::atomic<uint64_t> buckets[NumBuckets] {};
+	std::atomic<uint64_t> maxValue { 0 };
+};
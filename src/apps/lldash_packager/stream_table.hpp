@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+// Append-only array with a capacity fixed up front. Elements are never
+// moved, so references and indices stay valid until the table goes away,
+// and size() and operator[] can be used while another thread appends.
+// Appends themselves must be serialized by the caller.
+template<typename T>
+class StreamTable {
+	public:
+		void reserve(size_t capacity) {
+			if (count.load())
+				throw std::runtime_error("StreamTable: can't reserve a non-empty table");
+			items.reset(new std::unique_ptr<T>[capacity]);
+			cap = capacity;
+		}
+
+		template<typename... Args>
+		T& emplace_back(Args&&... args) {
+			auto const n = count.load(std::memory_order_relaxed);
+			if (n == cap)
+				throw std::runtime_error("StreamTable: capacity exceeded");
+			items[n].reset(new T(std::forward<Args>(args)...));
+			count.store(n + 1, std::memory_order_release);
+			return *items[n];
+		}
+
+		T& operator[](size_t i) {
+			return *items[i];
+		}
+
+		T const& operator[](size_t i) const {
+			return *items[i];
+		}
+
+		size_t size() const {
+			return count.load(std::memory_order_acquire);
+		}
+
+		size_t capacity() const {
+			return cap;
+		}
+
+		template<typename Table, typename Value>
+		struct Iterator {
+			Table* table;
+			size_t i;
+			Value& operator*() const {
+				return (*table)[i];
+			}
+			Iterator& operator++() {
+				++i;
+				return *this;
+			}
+			bool operator!=(Iterator const& other) const {
+				return i != other.i;
+			}
+		};
+
+		Iterator<StreamTable, T> begin() {
+			return { this, 0 };
+		}
+		Iterator<StreamTable, T> end() {
+			return { this, size() };
+		}
+		Iterator<StreamTable const, T const> begin() const {
+			return { this, 0 };
+		}
+		Iterator<StreamTable const, T const> end() const {
+			return { this, size() };
+		}
+
+	private:
+		std::unique_ptr<std::unique_ptr<T>[]> items;
+		size_t cap = 0;
+		std::atomic<size_t> count { 0 };
+};
@@ -1,4 +1,5 @@
 #include "../lldash_packager/lldash_packager.hpp"
+#include <algorithm>
 #include <chrono>
 #include <cstdio>
 #include <cstring>
@@ -18,6 +19,7 @@ std::vector<std::string> resolvePaths(std::string path) {
 			res.push_back(entry.path().string());
 		}
 	}
+	std::sort(res.begin(), res.end()); // replay in a stable order
 	return res;
 }
 
@@ -35,21 +37,42 @@ std::vector<uint8_t> loadFile(std::string filename) {
 		throw std::runtime_error(std::string("Can't read enough data for file \"") + filename + "\"");
 	return buf;
 }
+
+// Every file of a directory, loaded once.
+typedef std::vector<std::vector<uint8_t>> Corpus;
+
+Corpus loadCorpus(std::string path) {
+	Corpus corpus;
+	for (auto &filename : resolvePaths(path))
+		corpus.push_back(loadFile(filename));
+	if (corpus.empty())
+		throw std::runtime_error(std::string("No file found for path \"") + path + "\"");
+	return corpus;
+}
 }
 
 struct Config {
 	bool help = false;
-	std::string inputPath;
+	std::vector<std::string> inputPaths;
 	int segDurInMs = 2000;
 	int sleepAfterFrameInMs = 200;
+	double fps = 0;
+	int64_t numFrames = 0;
+	bool offline = false;
 	std::string publishUrl = ".";
+	std::string archivePath;
 };
 
 static void usage() {
-	fprintf(stderr, "Usage: %s [options, see below] [file_pattern]\n", g_appName);
+	fprintf(stderr, "Usage: %s [options, see below] input_dir [input_dir...]\n", g_appName);
+	fprintf(stderr, "\tWith several input directories, stream i replays input_dir[i %% count].\n");
 	Config cfg;
 	fprintf(stderr, "\t-d\tsegmentDurationInMs: 0=segmentTimeline, otherwise SegmentNumber (default: %d)\n", cfg.segDurInMs);
-	fprintf(stderr, "\t-s\tsleepAfterFrameInMs: sleep time in ms after each frame, used for regulation (default: %d)\n", cfg.sleepAfterFrameInMs);
+	fprintf(stderr, "\t-s\tsleepAfterFrameInMs: frame interval in ms, used for pacing (default: %d)\n", cfg.sleepAfterFrameInMs);
+	fprintf(stderr, "\t-r\tfps: target frame rate, paced on absolute deadlines; overrides -s (default: 1000/sleepAfterFrameInMs)\n");
+	fprintf(stderr, "\t-n\tnumFrames: stop after this many frames, 0=never (default: %lld)\n", (long long)cfg.numFrames);
+	fprintf(stderr, "\t-o\toffline: don't sleep, advance a virtual clock by sleepAfterFrameInMs after each frame instead\n");
+	fprintf(stderr, "\t-a\tarchivePath: also record each stream into a single MP4 file in this directory (default: none)\n");
 	fprintf(stderr, "\t-u\tpublishURL: if empty files are written and the node-gpac-http server should be used, otherwise use the Evanescent SFU. (default=\"%s\")\n", cfg.publishUrl.c_str());
 }
 
@@ -77,16 +100,28 @@ Config parseCommandLine(int argc, char* argv[]) {
 			opts.segDurInMs = atoi(pop().c_str());
 		else if (word == "-s")
 			opts.sleepAfterFrameInMs = atoi(pop().c_str());
+		else if (word == "-r")
+			opts.fps = atof(pop().c_str());
+		else if (word == "-n")
+			opts.numFrames = atoll(pop().c_str());
+		else if (word == "-o")
+			opts.offline = true;
+		else if (word == "-a")
+			opts.archivePath = pop();
 		else if (word == "-u")
 			opts.publishUrl = pop();
 		else
-			opts.inputPath = word;
+			opts.inputPaths.push_back(word);
 	}
 
-	if (opts.inputPath.empty()) {
+	if (opts.inputPaths.empty()) {
 		throw std::runtime_error("No input path. Aborting.");
 	}
 
+	if (opts.fps <= 0 && opts.sleepAfterFrameInMs <= 0) {
+		throw std::runtime_error("The frame interval (-s) or rate (-r) must be positive. Aborting.");
+	}
+
 	return opts;
 }
 
@@ -118,33 +153,86 @@ int safeMain(int argc, char* argv[]) {
 			}
 		}
 
+		// preload before the session starts: no disk access while pushing, no gap before the first frame
+		std::vector<Corpus> corpora;
+		for (auto &path : config.inputPaths)
+			corpora.push_back(loadCorpus(path));
+		printf("%d input(s) preloaded\n", (int)corpora.size());
+
 		// add trailing separator if not present
 		auto publishUrl = config.publishUrl;
 		if (isalnum(config.publishUrl.back()))
 			publishUrl += "/";
 
-		auto handle = lldpkg_create("vrtogether", [](const char* msg, int level) { fprintf(stderr, "Level %d message: %s\n", level, msg); }, VRTMessageInfo, numStreams, desc, publishUrl.c_str(), config.segDurInMs, 30000, LLDASH_PACKAGER_API_VERSION);
+		LLDashPackagerOptions options {};
+		if (config.offline)
+			options.clock_mode = VRTClockVirtual;
+		if (!config.archivePath.empty())
+			options.archive_path = config.archivePath.c_str();
+		auto handle = lldpkg_create_ex("vrtogether", [](const char* msg, int level) { fprintf(stderr, "Level %d message: %s\n", level, msg); }, VRTMessageInfo, numStreams, desc, publishUrl.c_str(), config.segDurInMs, 30000, &options, LLDASH_PACKAGER_API_VERSION);
 		if (!handle)
 			throw std::runtime_error("Can't create session");
 
-		auto paths = resolvePaths(config.inputPath);
-		if (paths.empty())
-			throw std::runtime_error(std::string("No file found for path \"") + config.inputPath + "\")");
+		int streamIndices[numStreams];
+		for (int j=0; j<numStreams; ++j)
+			streamIndices[j] = j;
 
-		int64_t i = 0;
-		while (1) {
-			auto buf = loadFile(paths[i % paths.size()]);
-			for (int j=0; j<numStreams; ++j)
-				if (!lldpkg_push_buffer(handle, j, buf.data(), buf.size()))
-					throw std::runtime_error("Can't push buffer");
+		using namespace std::chrono;
+		auto const period = duration_cast<steady_clock::duration>(config.fps > 0 ? duration<double>(1.0 / config.fps) : duration<double>(config.sleepAfterFrameInMs / 1000.0));
+		auto const start = steady_clock::now();
+		auto reportTime = start + seconds(1);
+		int64_t reportFrames = 0;
+		steady_clock::duration maxLateness {};
 
-			if (config.sleepAfterFrameInMs)
-				std::this_thread::sleep_for(std::chrono::milliseconds(config.sleepAfterFrameInMs));
+		int64_t i = 0;
+		while (config.numFrames == 0 || i < config.numFrames) {
+			bool res = true;
+			if (corpora.size() == 1) {
+				auto &buf = corpora[0][i % corpora[0].size()];
+				res = lldpkg_push_buffer_multi(handle, streamIndices, numStreams, buf.data(), buf.size());
+			} else {
+				// one batch: the tiles get the same timestamp
+				LLDashPackagerTile tiles[numStreams];
+				for (int j=0; j<numStreams; ++j) {
+					auto &corpus = corpora[j % corpora.size()];
+					auto &buf = corpus[i % corpus.size()];
+					tiles[j] = { j, buf.data(), buf.size() };
+				}
+				res = lldpkg_push_tiles(handle, tiles, numStreams, nullptr) == VRTPushOk;
+			}
+			if (!res)
+				throw std::runtime_error("Can't push buffer");
 
 			i++;
+
+			if (config.offline) {
+				lldpkg_advance_clock(handle, duration_cast<microseconds>(i * period).count(), 1000000);
+				continue;
+			}
+
+			// absolute deadlines: the pace doesn't drift with the push cost
+			auto const deadline = start + i * period;
+			auto const now = steady_clock::now();
+			if (now < deadline)
+				std::this_thread::sleep_until(deadline);
+			else
+				maxLateness = std::max(maxLateness, now - deadline);
+
+			if (now >= reportTime) {
+				auto const elapsed = duration<double>(now - start).count();
+				auto const expected = (int64_t)(elapsed / duration<double>(period).count());
+				printf("%.1f fps, %lld frame(s) behind schedule, max lateness %.1f ms\n",
+					(i - reportFrames) / (1.0 + duration<double>(now - reportTime).count()),
+					(long long)std::max<int64_t>(0, expected - i),
+					duration<double, std::milli>(maxLateness).count());
+				reportFrames = i;
+				reportTime = now + seconds(1);
+				maxLateness = {};
+			}
 		}
 
-		lldpkg_destroy(handle);
+		// offline, the static MPD is only complete once flushed
+		lldpkg_destroy(handle, config.offline);
 	} catch (std::exception const& e) {
 		fprintf(stderr, "[%s] Error: %s\n", g_appName, e.what());
 		return 1;
@@ -0,0 +1,387 @@
+#include "../lldash_packager/lldash_packager.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+const char *g_appName = "lldash_packager_bench";
+
+// Counts every allocation of the process. The library resolves operator new
+// to this definition where the platform allows symbol interposition (ELF).
+static std::atomic<uint64_t> g_numAllocs { 0 };
+
+void* operator new(size_t size) {
+	g_numAllocs.fetch_add(1, std::memory_order_relaxed);
+	if (auto p = malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept {
+	free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+
+namespace {
+std::vector<int> parseList(std::string s) {
+	std::vector<int> res;
+	size_t pos = 0;
+	while (pos <= s.size()) {
+		auto const comma = std::min(s.find(',', pos), s.size());
+		res.push_back(atoi(s.substr(pos, comma - pos).c_str()));
+		pos = comma + 1;
+	}
+	return res;
+}
+
+std::string toString(std::vector<int> const& list) {
+	std::string res;
+	for (auto v : list)
+		res += (res.empty() ? "" : ",") + std::to_string(v);
+	return res;
+}
+
+struct ProcessUsage {
+	double cpuInSec;
+	uint64_t peakRssInBytes;
+};
+
+ProcessUsage getProcessUsage() {
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+	auto toSec = [](FILETIME t) {
+		return (double)(((uint64_t)t.dwHighDateTime << 32) | t.dwLowDateTime) / 1e7;
+	};
+	PROCESS_MEMORY_COUNTERS mem {};
+	GetProcessMemoryInfo(GetCurrentProcess(), &mem, sizeof(mem));
+	return { toSec(kernel) + toSec(user), (uint64_t)mem.PeakWorkingSetSize };
+#else
+	rusage ru {};
+	getrusage(RUSAGE_SELF, &ru);
+	auto toSec = [](timeval t) {
+		return (double)t.tv_sec + (double)t.tv_usec / 1e6;
+	};
+#ifdef __APPLE__
+	uint64_t const rssUnit = 1; // bytes
+#else
+	uint64_t const rssUnit = 1024; // kilobytes
+#endif
+	return { toSec(ru.ru_utime) + toSec(ru.ru_stime), (uint64_t)ru.ru_maxrss * rssUnit };
+#endif
+}
+
+uint64_t percentile(std::vector<uint64_t> &sorted, int pct) {
+	if (sorted.empty())
+		return 0;
+	return sorted[std::min(sorted.size() - 1, sorted.size() * pct / 100)];
+}
+}
+
+struct Config {
+	bool help = false;
+	std::vector<int> frameSizes { 10000, 100000, 1000000 };
+	std::vector<int> frameRates { 30 };
+	std::vector<int> streamCounts { 1, 6 };
+	std::vector<int> segDursInMs { 1000 };
+	std::vector<int> threadings { VRTThreadingOnePerStream };
+	std::vector<int> waitStrategies { VRTWaitBlocking };
+	std::vector<int> fragmentFrames { 1 };
+	std::vector<int> producerCounts { 1 };
+	int runDurationInMs = 5000;
+	std::string publishUrl = "bench_output/";
+	int fileOutput = VRTFileDirect;
+	bool prewarm = false;
+};
+
+static void usage() {
+	fprintf(stderr, "Usage: %s [options, see below]\n", g_appName);
+	fprintf(stderr, "Every list option is comma-separated: all the combinations are run, and one JSON object per run is printed on stdout.\n");
+	Config cfg;
+	fprintf(stderr, "\t-f\tframe sizes in bytes (default: %s)\n", toString(cfg.frameSizes).c_str());
+	fprintf(stderr, "\t-r\tframe rates in fps, 0=as fast as possible (default: %s)\n", toString(cfg.frameRates).c_str());
+	fprintf(stderr, "\t-n\tstream counts (default: %s)\n", toString(cfg.streamCounts).c_str());
+	fprintf(stderr, "\t-d\tsegment durations in ms (default: %s)\n", toString(cfg.segDursInMs).c_str());
+	fprintf(stderr, "\t-m\tthreading: 0=one per stream, 1=pooled (default: %s)\n", toString(cfg.threadings).c_str());
+	fprintf(stderr, "\t-w\twait strategies: 0=blocking, 1=spin then block, 2=busy spin (default: %s)\n", toString(cfg.waitStrategies).c_str());
+	fprintf(stderr, "\t-a\tframes aggregated per fragment (default: %s)\n", toString(cfg.fragmentFrames).c_str());
+	fprintf(stderr, "\t-p\tproducer threads: the pushes are dealt round-robin over them, so they contend on the same streams (default: %s)\n", toString(cfg.producerCounts).c_str());
+	fprintf(stderr, "\t-t\tduration of each run in ms (default: %d)\n", cfg.runDurationInMs);
+	fprintf(stderr, "\t-u\tpublishURL, \"null\" discards the output in-process (default=\"%s\")\n", cfg.publishUrl.c_str());
+	fprintf(stderr, "\t-o\tfilesystem output: 0=direct, 1=write-behind I/O thread (default: %d)\n", cfg.fileOutput);
+	fprintf(stderr, "\t-W\tprewarm: prepare the handle before the measurement, which then only covers binding it\n");
+}
+
+Config parseCommandLine(int argc, char* argv[]) {
+	Config opts;
+
+	int argIdx = 1;
+
+	auto pop = [&]() {
+		if (argIdx >= argc)
+			throw std::runtime_error("Incomplete command line");
+		return std::string(argv[argIdx++]);
+	};
+
+	while (argIdx < argc) {
+		auto const word = pop();
+
+		if (word == "-h" || word == "--help") {
+			opts.help = true;
+			usage();
+			return opts;
+		}
+
+		if (word == "-f")
+			opts.frameSizes = parseList(pop());
+		else if (word == "-r")
+			opts.frameRates = parseList(pop());
+		else if (word == "-n")
+			opts.streamCounts = parseList(pop());
+		else if (word == "-d")
+			opts.segDursInMs = parseList(pop());
+		else if (word == "-m")
+			opts.threadings = parseList(pop());
+		else if (word == "-w")
+			opts.waitStrategies = parseList(pop());
+		else if (word == "-a")
+			opts.fragmentFrames = parseList(pop());
+		else if (word == "-p")
+			opts.producerCounts = parseList(pop());
+		else if (word == "-t")
+			opts.runDurationInMs = atoi(pop().c_str());
+		else if (word == "-u")
+			opts.publishUrl = pop();
+		else if (word == "-o")
+			opts.fileOutput = atoi(pop().c_str());
+		else if (word == "-W")
+			opts.prewarm = true;
+		else
+			throw std::runtime_error("Unknown option \"" + word + "\"");
+	}
+
+	return opts;
+}
+
+struct Run {
+	int frameSize, frameRate, numStreams, segDurInMs, threading, waitStrategy, fragmentFrames, producers;
+};
+
+static void runOne(Config const& config, Run const& run) {
+	std::vector<StreamDesc> desc(run.numStreams);
+	for (int i = 0; i < run.numStreams; ++i) {
+		auto &d = desc[i];
+		d.MP4_4CC = VRT_4CC('c','w','i','1');
+		d.objectX = i;
+		d.objectWidth = 1;
+		d.objectHeight = 1;
+		d.totalWidth = run.numStreams;
+		d.totalHeight = 1;
+	}
+
+	std::vector<LLDashPackagerStreamOptions> streamOpts(run.numStreams);
+	for (auto &o : streamOpts)
+		o.fragment_frames = run.fragmentFrames;
+
+	LLDashPackagerOptions opts {};
+	opts.stream_options = streamOpts.data();
+	opts.threading = run.threading;
+	opts.wait_strategy = run.waitStrategy;
+	opts.file_output = config.fileOutput;
+	if (config.publishUrl == "null")
+		opts.segment_callback = [](const LLDashPackagerSegment*, void*) {};
+
+	auto const onMessage = [](const char* msg, int level) { if (level <= VRTMessageWarning) fprintf(stderr, "Level %d message: %s\n", level, msg); };
+	lldpkg_handle* handle = nullptr;
+	if (config.prewarm) {
+		handle = lldpkg_prepare("bench", onMessage, VRTMessageWarning, run.numStreams, run.segDurInMs, 30000, &opts);
+		if (!handle)
+			throw std::runtime_error("Can't prepare session");
+	}
+	auto const createStart = std::chrono::steady_clock::now();
+	if (config.prewarm) {
+		if (!lldpkg_bind(handle, desc.data(), config.publishUrl.c_str()))
+			throw std::runtime_error("Can't bind session");
+	} else {
+		handle = lldpkg_create_ex("bench", onMessage, VRTMessageWarning, run.numStreams, desc.data(), config.publishUrl.c_str(), run.segDurInMs, 30000, &opts);
+		if (!handle)
+			throw std::runtime_error("Can't create session");
+	}
+	auto const createTimeInUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - createStart).count();
+
+	std::vector<uint8_t> payload(run.frameSize);
+	for (size_t i = 0; i < payload.size(); ++i)
+		payload[i] = (uint8_t)i;
+
+	auto const paced = run.frameRate > 0;
+	auto const period = std::chrono::nanoseconds(1000000000LL / std::max(1, run.frameRate));
+	auto const producers = std::max(1, run.producers);
+	auto const usageStart = getProcessUsage();
+	auto const allocsStart = g_numAllocs.load();
+	auto const start = std::chrono::steady_clock::now();
+	auto const end = start + std::chrono::milliseconds(config.runDurationInMs);
+
+	// push i of frame f goes to producer (f * numStreams + i) % producers
+	std::vector<std::vector<uint64_t>> producerLatenciesInNs(producers);
+	std::vector<int64_t> producerLatenessInUs(producers);
+	auto produce = [&](int k) {
+		auto &latencies = producerLatenciesInNs[k];
+		if (paced)
+			latencies.reserve((size_t)run.numStreams * run.frameRate * (config.runDurationInMs / 1000 + 1) / producers);
+		int64_t frame = 0;
+		auto deadline = start;
+		while (deadline < end) {
+			if (paced) {
+				std::this_thread::sleep_until(deadline);
+				producerLatenessInUs[k] = std::max<int64_t>(producerLatenessInUs[k], std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - deadline).count());
+			}
+			for (int j = 0; j < run.numStreams; ++j) {
+				if ((frame * run.numStreams + j) % producers != k)
+					continue;
+				auto const t0 = std::chrono::steady_clock::now();
+				lldpkg_try_push_buffer(handle, j, payload.data(), payload.size());
+				latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count());
+			}
+			frame++;
+			deadline = paced ? deadline + period : std::chrono::steady_clock::now();
+		}
+	};
+	std::vector<std::thread> producerThreads;
+	for (int k = 1; k < producers; ++k)
+		producerThreads.emplace_back(produce, k);
+	produce(0);
+	for (auto &t : producerThreads)
+		t.join();
+
+	std::vector<uint64_t> pushLatenciesInNs;
+	int64_t maxLatenessInUs = 0;
+	for (int k = 0; k < producers; ++k) {
+		pushLatenciesInNs.insert(pushLatenciesInNs.end(), producerLatenciesInNs[k].begin(), producerLatenciesInNs[k].end());
+		maxLatenessInUs = std::max(maxLatenessInUs, producerLatenessInUs[k]);
+	}
+
+	auto const elapsedInSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	auto const allocs = g_numAllocs.load() - allocsStart;
+	auto const usageEnd = getProcessUsage();
+
+	LLDashPackagerStats session {};
+	lldpkg_get_stats(handle, -1, &session);
+	LLDashPackagerLatency queue {}, mux {};
+	uint64_t dropped = 0;
+	for (int j = 0; j < run.numStreams; ++j) {
+		LLDashPackagerStats s {};
+		lldpkg_get_stats(handle, j, &s);
+		LLDashPackagerQueueStats q {};
+		lldpkg_get_queue_stats(handle, j, &q);
+		dropped += q.dropped + q.rejected;
+		// worst stream
+		if (s.queue.p99_ns > queue.p99_ns)
+			queue = s.queue;
+		if (s.mux.p99_ns > mux.p99_ns)
+			mux = s.mux;
+	}
+	lldpkg_destroy(handle);
+
+	std::sort(pushLatenciesInNs.begin(), pushLatenciesInNs.end());
+	auto const pushes = (double)pushLatenciesInNs.size();
+	auto latency = [](LLDashPackagerLatency const& l) {
+		return "{\"p50_us\":" + std::to_string(l.p50_ns / 1000.0) + ",\"p90_us\":" + std::to_string(l.p90_ns / 1000.0) + ",\"p99_us\":" + std::to_string(l.p99_ns / 1000.0) + ",\"max_us\":" + std::to_string(l.max_ns / 1000.0) + "}";
+	};
+
+	printf("{\"frame_size\":%d,\"frame_rate\":%d,\"streams\":%d,\"seg_dur_ms\":%d,\"threading\":%d,\"wait_strategy\":%d,\"fragment_frames\":%d,\"producers\":%d,"
+		"\"prewarm\":%s,\"create_us\":%lld,\"first_segment_ms\":%.3f,\"frames_per_sec\":%.2f,\"mb_per_sec\":%.3f,\"dropped\":%llu,\"max_pacing_lateness_us\":%lld,"
+		"\"container_overhead_bytes_per_frame\":%.1f,\"sink_calls_per_sec\":%.1f,\"mpd_bytes_per_sec\":%.1f,"
+		"\"push_us\":{\"p50\":%.3f,\"p99\":%.3f,\"max\":%.3f},\"queue\":%s,\"mux\":%s,\"dash\":%s,\"publish\":%s,\"end_to_end\":%s,"
+		"\"file_write_calls_per_sec\":%.1f,\"file_pruned\":%llu,"
+		"\"cpu_cores\":%.3f,\"peak_rss_bytes\":%llu,\"allocs_per_frame\":%.2f,\"pool_hit_ratio\":%.3f}\n",
+		run.frameSize, run.frameRate, run.numStreams, run.segDurInMs, run.threading, run.waitStrategy, run.fragmentFrames, producers,
+		config.prewarm ? "true" : "false", (long long)createTimeInUs, session.first_segment_ns / 1e6, session.frames / elapsedInSec, session.bytes / elapsedInSec / 1e6, (unsigned long long)dropped, (long long)maxLatenessInUs,
+		session.frames ? ((double)session.fragment_bytes - (double)session.bytes) / session.frames : 0.0, session.published / elapsedInSec, session.mpd_bytes / elapsedInSec,
+		percentile(pushLatenciesInNs, 50) / 1000.0, percentile(pushLatenciesInNs, 99) / 1000.0, (pushLatenciesInNs.empty() ? 0 : pushLatenciesInNs.back()) / 1000.0,
+		latency(queue).c_str(), latency(mux).c_str(), latency(session.dash).c_str(), latency(session.publish).c_str(), latency(session.end_to_end).c_str(),
+		session.file_write_calls / elapsedInSec, (unsigned long long)session.file_pruned,
+		(usageEnd.cpuInSec - usageStart.cpuInSec) / elapsedInSec, (unsigned long long)usageEnd.peakRssInBytes, pushes ? allocs / pushes : 0.0,
+		session.pool_hits + session.pool_misses ? (double)session.pool_hits / (session.pool_hits + session.pool_misses) : 0.0);
+	fflush(stdout);
+}
+
+// Runs in a child process so that the peak RSS is the one of this run
+// only. Windows has no fork(): the runs share the process, and the peak
+// RSS reported is the peak so far.
+static void runIsolated(Config const& config, Run const& run) {
+#ifdef _WIN32
+	runOne(config, run);
+#else
+	fflush(stdout);
+	fflush(stderr);
+	auto const pid = fork();
+	if (pid < 0)
+		throw std::runtime_error("Can't fork");
+	if (pid == 0) {
+		int res = 0;
+		try {
+			runOne(config, run);
+		} catch (std::exception const& e) {
+			fprintf(stderr, "[%s] Error: %s\n", g_appName, e.what());
+			res = 1;
+		}
+		fflush(stdout);
+		fflush(stderr);
+		_exit(res);
+	}
+
+	int status = 0;
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+		throw std::runtime_error("Run crashed");
+	if (WEXITSTATUS(status))
+		throw std::runtime_error("Run failed");
+#endif
+}
+
+int safeMain(int argc, char* argv[]) {
+	try {
+		auto config = parseCommandLine(argc, argv);
+		if(config.help)
+			return 0;
+
+		if (config.publishUrl != "null" && config.publishUrl.rfind("http", 0) != 0)
+			std::filesystem::create_directories(config.publishUrl);
+
+		for (auto frameSize : config.frameSizes)
+			for (auto frameRate : config.frameRates)
+				for (auto numStreams : config.streamCounts)
+					for (auto segDurInMs : config.segDursInMs)
+						for (auto threading : config.threadings)
+							for (auto waitStrategy : config.waitStrategies)
+								for (auto fragmentFrames : config.fragmentFrames)
+									for (auto producers : config.producerCounts)
+										runIsolated(config, { frameSize, frameRate, numStreams, segDurInMs, threading, waitStrategy, fragmentFrames, producers });
+	} catch (std::exception const& e) {
+		fprintf(stderr, "[%s] Error: %s\n", g_appName, e.what());
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	return safeMain(argc, argv);
+}